@@ -19,8 +19,12 @@ int main(int argc, char** argv)
         printf("Unable to access framebuffer\n");
     }
 
+    // The font is decoded once and kept beside the png, so later runs only
+    // have to map it
+    image_cache_persist(true);
+
     struct pixel_buffer font;
-    int result = load_image_format("/usr/share/font.png", &font, RGBA32);
+    int result = image_cache_load("/usr/share/font.png", &font, RGBA32);
 
     if (result)
     {
@@ -46,6 +50,7 @@ int main(int argc, char** argv)
     }
     
 
+    image_cache_release(&font);
     close_framebuffer();
 
     return 0;
@@ -21,6 +21,10 @@ struct bpp24
     uint8_t fields[3];
 };
 
+// Luminance of a color, with weights which add up to 256 so that gray stays
+// exactly the same
+#define PIXEL_LUMA(r, g, b) (((r) * 77 + (g) * 150 + (b) * 29) >> 8)
+
 static char* format_to_string(pixel_format fmt)
 {
     switch (fmt)
@@ -75,6 +79,12 @@ struct rgba32_pixel convert_pixel(pixel_format src_format, void* ptr, uint8_t bi
     {
         return *(struct rgba32_pixel*)ptr;
     }
+    else if (src_format == BGRA32)
+    {
+        struct bpp32 raw = *(struct bpp32*)ptr;
+
+        return (struct rgba32_pixel){.r = raw.fields[2], .g = raw.fields[1], .b = raw.fields[0], .a = raw.fields[3]};
+    }
     else if (src_format == BGR24)
     {
         struct bpp24 raw = *(struct bpp24*)ptr;
@@ -87,6 +97,12 @@ struct rgba32_pixel convert_pixel(pixel_format src_format, void* ptr, uint8_t bi
 
         return (struct rgba32_pixel){.r = raw.fields[0], .g = raw.fields[1], .b = raw.fields[2], .a=255};
     }
+    else if (src_format == GRAY8)
+    {
+        uint8_t value = *(uint8_t*)ptr;
+
+        return (struct rgba32_pixel){.r = value, .g = value, .b = value, .a=255};
+    }
     else
     {
         printf("Unable to read pixel in format %s, not yet implemented.\n", format_to_string(src_format));
@@ -94,40 +110,84 @@ struct rgba32_pixel convert_pixel(pixel_format src_format, void* ptr, uint8_t bi
     }
 }
 
+// Write an RGBA32 pixel in the given format, which must be one convert_pixel
+// can also read. Alpha is dropped by the formats without it, and gray takes
+// the luminance of the color.
+static void store_pixel(pixel_format dest_format, void* ptr, struct rgba32_pixel pixel)
+{
+    uint8_t* out = ptr;
+
+    switch (dest_format)
+    {
+    case RGBA32:
+        *(struct rgba32_pixel*)ptr = pixel;
+        break;
+    case BGRA32:
+        out[0] = pixel.b;
+        out[1] = pixel.g;
+        out[2] = pixel.r;
+        out[3] = pixel.a;
+        break;
+    case RGB24:
+        out[0] = pixel.r;
+        out[1] = pixel.g;
+        out[2] = pixel.b;
+        break;
+    case BGR24:
+        out[0] = pixel.b;
+        out[1] = pixel.g;
+        out[2] = pixel.r;
+        break;
+    case GRAY8:
+        out[0] = PIXEL_LUMA(pixel.r, pixel.g, pixel.b);
+        break;
+    }
+}
+
+// Whether pixels in a format can be read by convert_pixel and written by
+// store_pixel
+static bool can_convert(pixel_format fmt)
+{
+    return fmt == RGBA32 || fmt == BGRA32 || fmt == RGB24 || fmt == BGR24 || fmt == GRAY8;
+}
+
 // Attempts to convert the format of the pixel_buffer. Note that this function allocates a new buffer, meaning the original buffer must be freed seperately.
+// Returns -1, with nothing allocated, if either format isn't supported.
 int convert_pixel_buffer(pixel_format dest_format, struct pixel_buffer* dest, struct pixel_buffer* src)
 {
+    if (dest_format != src->fmt && (!can_convert(dest_format) || !can_convert(src->fmt)))
+    {
+        printf("Unable to convert from format %s to format %s, not yet implemented.\n", format_to_string(src->fmt), format_to_string(dest_format));
+        return -1;
+    }
+
     *dest = alloc_pixel_buffer(dest_format, src->width, src->height);
 
+    if (dest->raw_buffer == NULL)
+    {
+        return -1;
+    }
+
     if (dest_format == src->fmt)
     {
         memcpy(dest->raw_buffer, src->raw_buffer, (GET_BITS_PER_PIXEL(dest_format) * src->width * src->height + 7) / 8);
     }
-    else if (dest_format == RGBA32)
+    else
     {
-        size_t bpp = GET_BITS_PER_PIXEL(src->fmt);
-        if (bpp % 8 != 0)
-        {
-            printf("Unable to convert from a format which is not byte aligned, not implemented.\n");
-            exit(1);
-        }
+        size_t src_bpp = GET_BITS_PER_PIXEL(src->fmt);
+        size_t dest_bpp = GET_BITS_PER_PIXEL(dest_format);
 
         for (size_t y = 0; y < src->height; y++)
         {
-            struct rgba32_pixel* dest_line = dest->raw_buffer + y * dest->line_length / 8;
+            void* dest_line = dest->raw_buffer + y * dest->line_length / 8;
             void* src_line = src->raw_buffer + y * src->line_length / 8;
 
             for (size_t x = 0; x < src->width; x++)
             {
-                dest_line[x] = convert_pixel(src->fmt, src_line + x * bpp / 8, 0);
+                store_pixel(dest_format, dest_line + x * dest_bpp / 8, convert_pixel(src->fmt, src_line + x * src_bpp / 8, 0));
             }
         }
     }
-    else
-    {
-        printf("Unable to convert from format %s to format %s, not yet implemented.\n", format_to_string(src->fmt), format_to_string(dest_format));
-        exit(1);
-    }
 
     return 0;
 }
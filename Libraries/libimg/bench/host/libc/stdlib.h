@@ -0,0 +1,2 @@
+// Host shim for building against the system C library
+#include <stdlib.h>
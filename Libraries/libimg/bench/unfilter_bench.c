@@ -0,0 +1,184 @@
+// Host-side benchmark comparing the word-at-a-time PNG unfilter routines with
+// straightforward byte-at-a-time loops, for every pixel size and filter type.
+// The results of both are compared first, over rows of every length up to a
+// few words, so the word loops and their leftover bytes are both checked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "unfilter.h"
+
+#define ROW_LENGTH 4096
+#define ROWS 256
+
+static const char* filter_names[PNG_FILTERS] = {"none", "sub", "up", "average", "paeth"};
+static const size_t pixel_sizes[] = {1, 2, 3, 4, 6, 8};
+
+// Current time in seconds
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint8_t paeth_byte(uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = (int)a + (int)b - (int)c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+    {
+        return a;
+    }
+    else if (pb <= pc)
+    {
+        return b;
+    }
+
+    return c;
+}
+
+// Unfilter a row one byte at a time, checking for the left edge on every byte
+static void reference_unfilter(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t length, size_t bpp)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = prev[i];
+        uint8_t c = i >= bpp ? prev[i - bpp] : 0;
+
+        if (filter == 1)
+        {
+            row[i] += a;
+        }
+        else if (filter == 2)
+        {
+            row[i] += b;
+        }
+        else if (filter == 3)
+        {
+            row[i] += (a + b) / 2;
+        }
+        else if (filter == 4)
+        {
+            row[i] += paeth_byte(a, b, c);
+        }
+    }
+}
+
+// Check the routines against the reference for every length of row up to a
+// few words, returns 0 if they all agree
+static int check(size_t bpp)
+{
+    const unfilter_fn* routines = unfilter_routines(bpp);
+
+    uint64_t prev_words[8];
+    uint64_t row_words[8];
+    uint8_t expected[64];
+
+    uint8_t* prev = (uint8_t*)prev_words;
+    uint8_t* row = (uint8_t*)row_words;
+
+    for (size_t length = bpp; length <= sizeof(expected); length += bpp)
+    {
+        for (uint8_t filter = 1; filter < PNG_FILTERS; filter++)
+        {
+            for (size_t trial = 0; trial < 100; trial++)
+            {
+                for (size_t i = 0; i < length; i++)
+                {
+                    prev[i] = rand();
+                    row[i] = rand();
+                }
+
+                memcpy(expected, row, length);
+                reference_unfilter(filter, expected, prev, length, bpp);
+                routines[filter](row, prev, length);
+
+                if (memcmp(expected, row, length) != 0)
+                {
+                    printf("Mismatch: %zu byte pixels, %s filter, %zu byte row\n", bpp, filter_names[filter], length);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20;
+
+    // Each row is unfiltered against the one before, as it would be in an
+    // image, starting from a row of zeros
+    uint8_t* filtered = malloc(ROW_LENGTH * ROWS);
+    uint8_t* image = aligned_alloc(8, ROW_LENGTH * (ROWS + 1));
+
+    for (size_t i = 0; i < ROW_LENGTH * ROWS; i++)
+    {
+        filtered[i] = rand();
+    }
+
+    printf("bpp  filter    reference MB/s  routine MB/s  speedup\n");
+
+    for (size_t p = 0; p < sizeof(pixel_sizes) / sizeof(pixel_sizes[0]); p++)
+    {
+        size_t bpp = pixel_sizes[p];
+
+        if (check(bpp))
+        {
+            return 1;
+        }
+
+        const unfilter_fn* routines = unfilter_routines(bpp);
+
+        for (uint8_t filter = 1; filter < PNG_FILTERS; filter++)
+        {
+            double times[2];
+
+            for (size_t version = 0; version < 2; version++)
+            {
+                double start = now();
+
+                for (size_t n = 0; n < iterations; n++)
+                {
+                    memset(image, 0, ROW_LENGTH);
+                    memcpy(image + ROW_LENGTH, filtered, ROW_LENGTH * ROWS);
+
+                    for (size_t y = 1; y <= ROWS; y++)
+                    {
+                        uint8_t* row = image + y * ROW_LENGTH;
+
+                        if (version == 0)
+                        {
+                            reference_unfilter(filter, row, row - ROW_LENGTH, ROW_LENGTH, bpp);
+                        }
+                        else
+                        {
+                            routines[filter](row, row - ROW_LENGTH, ROW_LENGTH);
+                        }
+                    }
+                }
+
+                times[version] = now() - start;
+            }
+
+            double megabytes = (double)ROW_LENGTH * ROWS * iterations / (1024.0 * 1024.0);
+
+            printf("%3zu  %-8s  %14.1f  %12.1f  %6.2fx\n", bpp, filter_names[filter], megabytes / times[0], megabytes / times[1], times[0] / times[1]);
+        }
+    }
+
+    free(filtered);
+    free(image);
+
+    return 0;
+}
@@ -14,37 +14,143 @@ struct bmp_pixel
     uint8_t r;
 };
 
-// Load a bitmap image from a buffer into an image data buffer
-int image_backend_bmp(void* buffer, struct pixel_buffer* data)
+// Copy a line of BGR24 pixels into a line of the image
+static inline void copy_line(uint8_t* out, const uint8_t* src, size_t width, pixel_format fmt)
+{
+    size_t size = GET_BITS_PER_PIXEL(fmt) / 8;
+
+    for (size_t x = 0; x < width; x++)
+    {
+        const struct bmp_pixel* pixel = (const struct bmp_pixel*)(src + 3 * x);
+
+        if (fmt == RGB24 || fmt == RGBA32)
+        {
+            out[0] = pixel->r;
+            out[1] = pixel->g;
+            out[2] = pixel->b;
+        }
+        else
+        {
+            out[0] = pixel->b;
+            out[1] = pixel->g;
+            out[2] = pixel->r;
+        }
+
+        if (size == 4)
+        {
+            out[3] = 255;
+        }
+
+        out += size;
+    }
+}
+
+// Check the header of a bitmap is one which can be loaded, returns 0 if it is
+// and -1 if it isn't
+static int check_header(const BitmapHeader* header, size_t length)
+{
+    // Verify that the buffer has the proper magic number
+    if (length < sizeof(BitmapHeader) || header->magic0 != 'B' || header->magic1 != 'M')
+    {
+        return -1;
+    }
+
+    // Only uncompressed 24 bit bottom up bitmaps are supported
+    if (header->bits_per_pixel != 24 || header->compression_method != 0 || header->width <= 0 || header->height <= 0)
+    {
+        printf("Unsupported bitmap\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Load a bitmap image from a buffer of the given length into an image data
+// buffer, converting it into the given format as it is copied if it is one of
+// the 24 or 32 bit color formats, and otherwise leaving it as BGR24
+int image_backend_bmp(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt)
 {
     // First load the buffer as a bitmap header
     BitmapHeader* header = (BitmapHeader*)buffer;
 
-    // Verify that the buffer has the proper magic number
-    if (header->magic0 != 'B' || header->magic1 != 'M')
+    if (check_header(header, length))
     {
         return -1;
     }
 
+    // Calculate the length of a line, which is padded to a multiple of four
+    // bytes in the file but not in the image
+    size_t line_length = 3 * (size_t)header->width;
+    line_length += (4 - (line_length % 4)) % 4;
+
+    // The pixel data is read straight from the file, so it must all be there
+    if (header->pixel_data_offset < 0 || (size_t)header->pixel_data_offset > length || line_length * header->height > length - header->pixel_data_offset)
+    {
+        printf("Truncated bitmap\n");
+        return -1;
+    }
+
+    if (fmt != RGB24 && fmt != RGBA32 && fmt != BGRA32)
+    {
+        fmt = BGR24;
+    }
+
     // Allocate the pixel buffer
-    *data = alloc_pixel_buffer(BGR24, (size_t)header->width, (size_t)header->height);
+    *data = alloc_pixel_buffer(fmt, (size_t)header->width, (size_t)header->height);
+
+    if (data->raw_buffer == NULL)
+    {
+        return -1;
+    }
 
     // Get a pointer into the bitmap file at the beginning of the pixel data
     uint8_t* pixel_data = (uint8_t*)((size_t)buffer + (size_t)header->pixel_data_offset);
 
-    // Calculate the length of a line
-    size_t line_length = 3 * data->width;
-    line_length += (4 - (line_length % 4)) % 4;
-
     // Iterate over every line, copying the data into the buffer
     void* output_buffer = data->raw_buffer;
     for (size_t y = 0; y < data->height; y++)
     {
-        memcpy(output_buffer, pixel_data + line_length * (data->height - 1 - y), line_length);
+        const uint8_t* line = pixel_data + line_length * (data->height - 1 - y);
+
+        switch (fmt)
+        {
+            case BGR24:
+                memcpy(output_buffer, line, 3 * data->width);
+                break;
+            case RGB24:
+                copy_line(output_buffer, line, data->width, RGB24);
+                break;
+            case RGBA32:
+                copy_line(output_buffer, line, data->width, RGBA32);
+                break;
+            case BGRA32:
+                copy_line(output_buffer, line, data->width, BGRA32);
+                break;
+        }
 
         // Step the output buffer forwards by the size of a line
         output_buffer += data->line_length / 8;
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Read the size and layout of a bitmap image from the start of a file, which
+// must hold at least the header. Returns 0 on success and -1 on failure.
+int image_probe_bmp(void* buffer, size_t length, struct image_info* info)
+{
+    BitmapHeader* header = (BitmapHeader*)buffer;
+
+    if (check_header(header, length))
+    {
+        return -1;
+    }
+
+    info->width = header->width;
+    info->height = header->height;
+    info->fmt = BGR24;
+    info->bit_depth = 8;
+    info->interlaced = false;
+
+    return 0;
+}
@@ -27,7 +27,13 @@ typedef struct bitmap_header
     int important_colors;
 } __attribute__((packed)) BitmapHeader;
 
-// Load a bitmap image from a buffer into an image data buffer
-int image_backend_bmp(void* buffer, struct pixel_buffer* data);
+// Load a bitmap image from a buffer of the given length into an image data
+// buffer, converting it into the given format as it is copied if it is one of
+// the 24 or 32 bit color formats, and otherwise leaving it as BGR24
+int image_backend_bmp(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt);
+
+// Read the size and layout of a bitmap image from the start of a file, which
+// must hold at least the header. Returns 0 on success and -1 on failure.
+int image_probe_bmp(void* buffer, size_t length, struct image_info* info);
 
 #endif // BMP_H
\ No newline at end of file
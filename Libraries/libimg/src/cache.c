@@ -0,0 +1,370 @@
+#include "libimg.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+#include <libc/sys/stat.h>
+
+#include "graphics.h"
+
+#include "generic.h"
+#include "raw.h"
+
+/*
+    Images loaded through the cache are kept, decoded, for as long as anything
+    holds them and then for as long as they fit within the byte budget, so
+    loading the same file again in the same format just hands out the same
+    pixels. An entry is only reused while the file's modification time is the
+    one it was loaded with.
+
+    Entries are kept in a list from the most to the least recently used. The
+    budget only covers the entries which nothing holds, and once those are
+    over budget the least recently used of them are dropped. Entries in use
+    are never dropped, and take memory on top of the budget for as long as
+    they are held.
+
+    With persisting turned on, each image decoded is also written as a raw
+    image next to the file, which later loads (in this process or any other)
+    map instead of decoding the file again, as long as it was written after
+    the file was last changed. Raw images loaded in their own format are
+    mapped in the same way.
+*/
+
+#define DEFAULT_BUDGET (4 * 1024 * 1024)
+
+struct cache_entry
+{
+    char* filename;
+    long mtime;
+    pixel_format fmt;
+
+    struct pixel_buffer buffer;
+    size_t size;
+    size_t references;
+
+    // Set when the pixels are within a raw image file (or a persisted copy)
+    // brought into memory, rather than a buffer of their own
+    bool from_file;
+    struct image_file file;
+
+    struct cache_entry* prev;
+    struct cache_entry* next;
+};
+
+static struct cache_entry* cache_head = NULL;
+static struct cache_entry* cache_tail = NULL;
+
+// Bytes taken by the entries which nothing holds
+static size_t cache_idle_size = 0;
+static size_t cache_budget = DEFAULT_BUDGET;
+static bool cache_persist = false;
+
+// Take an entry out of the list
+static void unlink_entry(struct cache_entry* entry)
+{
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        cache_head = entry->next;
+    }
+
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        cache_tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+// Put an entry at the front of the list, as the most recently used
+static void push_entry(struct cache_entry* entry)
+{
+    entry->prev = NULL;
+    entry->next = cache_head;
+
+    if (cache_head != NULL)
+    {
+        cache_head->prev = entry;
+    }
+    else
+    {
+        cache_tail = entry;
+    }
+
+    cache_head = entry;
+}
+
+// Take an entry out of the cache and free everything it holds
+static void drop_entry(struct cache_entry* entry)
+{
+    unlink_entry(entry);
+
+    if (entry->references == 0)
+    {
+        cache_idle_size -= entry->size;
+    }
+
+    if (entry->from_file)
+    {
+        close_image_file(&entry->file);
+    }
+    else
+    {
+        free_pixel_buffer(entry->buffer);
+    }
+
+    free(entry->filename);
+    free(entry);
+}
+
+// Drop the least recently used entries which nothing holds until those left
+// are within the budget
+static void trim_cache()
+{
+    struct cache_entry* entry = cache_tail;
+
+    while (entry != NULL && cache_idle_size > cache_budget)
+    {
+        struct cache_entry* prev = entry->prev;
+
+        if (entry->references == 0)
+        {
+            drop_entry(entry);
+        }
+
+        entry = prev;
+    }
+}
+
+// Name of the persisted copy of a file in the given format, which must be
+// freed by the caller. Returns a null pointer on failure.
+static char* persisted_name(const char* filename, pixel_format fmt)
+{
+    char* name = malloc(strlen(filename) + 8);
+
+    if (name != NULL)
+    {
+        sprintf(name, "%s.%02x.raw", filename, fmt);
+    }
+
+    return name;
+}
+
+// Use the pixels of a raw image file where they are, if it is in the format of
+// the entry. Returns 0 on success and -1 on failure.
+static int map_raw_image(struct cache_entry* entry, const char* filename)
+{
+    if (open_image_file(filename, &entry->file))
+    {
+        return -1;
+    }
+
+    if (raw_image_view(entry->file.buffer, entry->file.length, &entry->buffer) || entry->buffer.fmt != entry->fmt)
+    {
+        close_image_file(&entry->file);
+        return -1;
+    }
+
+    entry->from_file = true;
+
+    return 0;
+}
+
+// Whether a file is named as a raw image
+static bool is_raw_image(const char* filename)
+{
+    size_t length = strlen(filename);
+
+    return length >= 4 && strcmp(filename + length - 4, ".raw") == 0;
+}
+
+// Bring in the persisted copy of a file if there is one which is newer than
+// the file, returns 0 on success and -1 on failure. A copy from the same
+// second as the file may have been written before the file last changed, so
+// it is not used.
+static int load_persisted(struct cache_entry* entry)
+{
+    char* name = persisted_name(entry->filename, entry->fmt);
+
+    if (name == NULL)
+    {
+        return -1;
+    }
+
+    struct stat info;
+    int result = -1;
+
+    if (stat(name, &info) >= 0 && info.st_mtime > entry->mtime)
+    {
+        result = map_raw_image(entry, name);
+    }
+
+    free(name);
+
+    return result;
+}
+
+// Write the persisted copy of an entry, failing quietly as the copy only
+// saves time
+static void write_persisted(struct cache_entry* entry)
+{
+    char* name = persisted_name(entry->filename, entry->fmt);
+
+    if (name != NULL)
+    {
+        raw_image_write(name, &entry->buffer);
+        free(name);
+    }
+}
+
+// Load an image through the cache, in the given format. The pixels are shared
+// with every other load of the same file in the same format, so they must not
+// be changed, and the buffer must be given back with image_cache_release
+// rather than freed. A raw image already in the format is mapped and used
+// where it is, without a copy. Returns -1 on failure and 0 on success.
+int image_cache_load(const char* filename, struct pixel_buffer* data, pixel_format fmt)
+{
+    struct stat info;
+
+    if (stat(filename, &info) < 0)
+    {
+        return -1;
+    }
+
+    struct cache_entry* entry = cache_head;
+
+    while (entry != NULL)
+    {
+        struct cache_entry* next = entry->next;
+
+        if (entry->fmt == fmt && strcmp(entry->filename, filename) == 0)
+        {
+            if (entry->mtime == info.st_mtime)
+            {
+                break;
+            }
+
+            // The file has changed, so nothing will load this entry again
+            if (entry->references == 0)
+            {
+                drop_entry(entry);
+            }
+        }
+
+        entry = next;
+    }
+
+    if (entry != NULL)
+    {
+        unlink_entry(entry);
+
+        if (entry->references == 0)
+        {
+            cache_idle_size -= entry->size;
+        }
+    }
+    else
+    {
+        entry = malloc(sizeof(struct cache_entry));
+
+        if (entry == NULL)
+        {
+            return -1;
+        }
+
+        memset(entry, 0, sizeof(struct cache_entry));
+
+        entry->filename = malloc(strlen(filename) + 1);
+        entry->mtime = info.st_mtime;
+        entry->fmt = fmt;
+
+        if (entry->filename == NULL)
+        {
+            free(entry);
+            return -1;
+        }
+
+        strcpy(entry->filename, filename);
+
+        bool raw = is_raw_image(filename);
+
+        // Raw images are used where they are if they are in the format, and
+        // are never persisted as they take no decoding
+        if (raw ? map_raw_image(entry, filename) != 0 : (!cache_persist || load_persisted(entry) != 0))
+        {
+            if (load_image_format(filename, &entry->buffer, fmt))
+            {
+                free(entry->filename);
+                free(entry);
+                return -1;
+            }
+
+            if (cache_persist && !raw)
+            {
+                write_persisted(entry);
+            }
+        }
+
+        entry->size = entry->buffer.line_length / 8 * entry->buffer.height;
+    }
+
+    entry->references++;
+    push_entry(entry);
+
+    trim_cache();
+
+    *data = entry->buffer;
+
+    return 0;
+}
+
+// Give back an image loaded with image_cache_load, which is then kept for as
+// long as it fits within the budget
+void image_cache_release(struct pixel_buffer* data)
+{
+    for (struct cache_entry* entry = cache_head; entry != NULL; entry = entry->next)
+    {
+        if (entry->buffer.raw_buffer == data->raw_buffer && entry->references > 0)
+        {
+            entry->references--;
+
+            if (entry->references == 0)
+            {
+                cache_idle_size += entry->size;
+            }
+
+            break;
+        }
+    }
+
+    data->raw_buffer = NULL;
+
+    trim_cache();
+}
+
+// Set the number of bytes of decoded images which nothing holds that the cache
+// keeps, on top of those which are still held. The default is 4 MiB, and 0
+// keeps nothing which isn't in use.
+void image_cache_budget(size_t bytes)
+{
+    cache_budget = bytes;
+
+    trim_cache();
+}
+
+// Choose whether images loaded through the cache are also written, decoded,
+// next to the file (as the name of the file followed by the format in hex and
+// .raw), so that later loads in any process can map them instead of decoding
+// the file. This is off by default.
+void image_cache_persist(bool persist)
+{
+    cache_persist = persist;
+}
@@ -1,24 +1,71 @@
 #include "libimg.h"
 
-#include <libc/errno.h>
+#include <libc/fcntl.h>
 #include <libc/stdio.h>
 #include <libc/stdlib.h>
 #include <libc/string.h>
+#include <libc/sys/stat.h>
+#include <libc/sys/syscalls.h>
+#include <libc/unistd.h>
 
 #include "graphics.h"
 
 #include "bmp.h"
+#include "generic.h"
 #include "png.h"
+#include "qoi.h"
+#include "raw.h"
+
+bool image_checksums_enabled = true;
+
+image_progress_fn image_progress = NULL;
+void* image_progress_context = NULL;
+
+// Choose whether the checksums stored in image files (such as the chunk crcs of
+// a png) are verified while loading, this is on by default
+void image_verify_checksums(bool verify)
+{
+    image_checksums_enabled = verify;
+}
+
+// Choose a function to call as each pass of an interlaced image is loaded, or a
+// null pointer for none (the default). The context is passed along to it.
+void image_progress_callback(image_progress_fn callback, void* context)
+{
+    image_progress = callback;
+    image_progress_context = context;
+}
+
+// Functions for one kind of image, each given the whole file, or at least the
+// start of it in the case of probe
+struct image_backend
+{
+    const char* extension;
+
+    int (*load)(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt);
+    int (*probe)(void* buffer, size_t length, struct image_info* info);
+};
+
+static const struct image_backend image_backends[] =
+{
+    {.extension = "bmp", .load = image_backend_bmp, .probe = image_probe_bmp},
+    {.extension = "png", .load = image_backend_png, .probe = image_probe_png},
+    {.extension = "qoi", .load = image_backend_qoi, .probe = image_probe_qoi},
+    {.extension = "raw", .load = image_backend_raw, .probe = image_probe_raw},
+};
+
+// Enough of the start of a file to hold the header of any kind of image
+#define PROBE_LENGTH 64
 
 // Load an image with a generic backend
-int load_image_from_backend(int (*backend)(void*, struct pixel_buffer*), void* buffer, struct pixel_buffer* data)
+int load_image_from_backend(int (*backend)(void*, size_t, struct pixel_buffer*, pixel_format), void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt)
 {
-    return backend(buffer, data);
+    return backend(buffer, length, data, fmt);
 }
 
-// Load an image from file into a buffer which can later be free()ed. Returns
-// -1 on failure, and 0 on success.
-int load_image(const char* filename, struct pixel_buffer* image_data_ptr)
+// Pick the backend for a file by its extension, returns a null pointer if
+// there is none
+static const struct image_backend* find_backend(const char* filename)
 {
     const char* walk = filename;
     const char* suffix = strchr(walk, '.');
@@ -29,54 +76,203 @@ int load_image(const char* filename, struct pixel_buffer* image_data_ptr)
         suffix = strchr(walk, '.');
     }
 
-    int (*backend)(void*, struct pixel_buffer*);
+    for (size_t i = 0; i < sizeof(image_backends) / sizeof(image_backends[0]); i++)
+    {
+        if (strcmp(walk, image_backends[i].extension) == 0)
+        {
+            return &image_backends[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Bring the whole of a file into memory, returns 0 on success and -1 on
+// failure
+int open_image_file(const char* filename, struct image_file* file)
+{
+    struct stat info;
+
+    if (stat(filename, &info) < 0 || info.st_size <= 0)
+    {
+        return -1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    file->length = info.st_size;
+
+    // The backends only read the file, so it is mapped rather than copied
+    void* mapped = sys_mmap(0, file->length, PROT_READ, MAP_SHARED, fd, 0);
+
+    if ((long)mapped >= 0)
+    {
+        file->buffer = mapped;
+        file->mapped = true;
+        close(fd);
+
+        return 0;
+    }
+
+    // Not every file can be mapped, so otherwise it is read in one go
+    file->buffer = malloc(file->length);
+    file->mapped = false;
+
+    size_t total = 0;
+
+    while (file->buffer != NULL && total < file->length)
+    {
+        long count = read(fd, file->buffer + total, file->length - total);
+
+        if (count <= 0)
+        {
+            break;
+        }
+
+        total += count;
+    }
+
+    close(fd);
 
-    if (strcmp(walk, "bmp") == 0)
+    if (total < file->length)
     {
-        backend = image_backend_bmp;
+        free(file->buffer);
+        return -1;
     }
-    else if (strcmp(walk, "png") == 0)
+
+    return 0;
+}
+
+// Release the memory holding a file brought in by open_image_file
+void close_image_file(struct image_file* file)
+{
+    if (file->mapped)
     {
-        backend = image_backend_png;
+        sys_munmap(file->buffer, file->length);
     }
     else
+    {
+        free(file->buffer);
+    }
+}
+
+/*
+    Each backend is given the format the image is wanted in, and converts the
+    pixels into it as they are decoded when it can, so the usual loads take a
+    single pass and never hold a second copy of the image. A backend which
+    can't produce the format (and a format of 0, which is none) decodes into
+    the format closest to the image's own instead.
+*/
+static int load_image_as(const char* filename, struct pixel_buffer* image_data_ptr, pixel_format fmt)
+{
+    const struct image_backend* backend = find_backend(filename);
+
+    if (backend == NULL)
     {
         return -1;
     }
 
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL || errno != 0)
+    struct image_file file;
+
+    if (open_image_file(filename, &file))
     {
         return -1;
     }
 
-    void* buffer = malloc(1024 * 128);
-    size_t length = fread(buffer, 1, 1024 * 128, file);
-    if (errno != 0)
+    int result = backend->load(file.buffer, file.length, image_data_ptr, fmt);
+
+    close_image_file(&file);
+
+    return result != 0 ? -1 : 0;
+}
+
+// Read the size and layout of an image from the header of the file, without
+// loading the image itself. Returns -1 on failure and 0 on success.
+int image_probe(const char* filename, struct image_info* info)
+{
+    const struct image_backend* backend = find_backend(filename);
+
+    if (backend == NULL)
     {
         return -1;
     }
 
-    fclose(file);
-    if (errno != 0)
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
     {
         return -1;
     }
 
-    if (backend(buffer, image_data_ptr) != 0)
+    // Only the start of the file is read, which may be all of a small one
+    uint8_t header[PROBE_LENGTH];
+    size_t length = 0;
+
+    while (length < PROBE_LENGTH)
+    {
+        long count = read(fd, header + length, PROBE_LENGTH - length);
+
+        if (count <= 0)
+        {
+            break;
+        }
+
+        length += count;
+    }
+
+    close(fd);
+
+    return backend->probe(header, length, info) != 0 ? -1 : 0;
+}
+
+// Load an image from file into a buffer which can later be free()ed. Returns
+// -1 on failure, and 0 on success.
+int load_image(const char* filename, struct pixel_buffer* image_data_ptr)
+{
+    return load_image_as(filename, image_data_ptr, 0);
+}
+
+// Write an image to a file in the raw format, which holds the pixels exactly
+// as they are in memory so it can be loaded with no decoding at all. Returns
+// -1 on failure and 0 on success.
+int image_save_raw(const char* filename, struct pixel_buffer* data)
+{
+    return raw_image_write(filename, data);
+}
+
+// Write an image to a file as a quite ok image, which is small and quick to
+// decode. Returns -1 on failure and 0 on success.
+int image_save_qoi(const char* filename, struct pixel_buffer* data)
+{
+    size_t length;
+    void* encoded = qoi_encode(data, &length);
+
+    if (encoded == NULL)
     {
         return -1;
     }
 
-    free(buffer);
+    FILE* file = fopen(filename, "wb");
+    bool written = file != NULL && fwrite(encoded, 1, length, file) == length;
 
-    return 0;
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    free(encoded);
+
+    return written ? 0 : -1;
 }
 
 int load_image_format(const char* filename, struct pixel_buffer* data, pixel_format fmt)
 {
-    // First load the image in its native format
-    int result = load_image(filename, data);
+    int result = load_image_as(filename, data, fmt);
 
     if (result)
         return result;
@@ -86,12 +282,16 @@ int load_image_format(const char* filename, struct pixel_buffer* data, pixel_for
         return 0;
     }
 
+    // The backend couldn't decode into the format, so convert it afterwards
     struct pixel_buffer temp;
 
     result = convert_pixel_buffer(fmt, &temp, data);
 
     if (result)
+    {
+        free_pixel_buffer(*data);
         return -1;
+    }
 
     free_pixel_buffer(*data);
     *data = temp;
@@ -0,0 +1,22 @@
+#ifndef GENERIC_H
+#define GENERIC_H
+
+#include "libimg.h"
+
+// The whole of an image file, mapped into memory if possible and otherwise
+// read into a buffer of its exact size
+struct image_file
+{
+    void* buffer;
+    size_t length;
+    bool mapped;
+};
+
+// Bring the whole of a file into memory, returns 0 on success and -1 on
+// failure
+int open_image_file(const char* filename, struct image_file* file);
+
+// Release the memory holding a file brought in by open_image_file
+void close_image_file(struct image_file* file);
+
+#endif // GENERIC_H
@@ -1,6 +1,5 @@
 #include "png.h"
 
-#include <libc/assert.h>
 #include <libc/stdio.h>
 #include <libc/string.h>
 
@@ -8,8 +7,18 @@
 #include "graphics.h"
 #include "libzip.h"
 
+#include "unfilter.h"
+
 #define BIG_ENDIAN32(v) (((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v & 0xFF0000) >> 8) | ((v & 0xFF000000) >> 24))
-#define ABS(x) ((x < 0) ? -(x) : (x))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Color types, which are bit flags for using a palette, color and alpha
+#define PNG_GRAY 0
+#define PNG_RGB 2
+#define PNG_PALETTE 3
+#define PNG_GRAY_ALPHA 4
+#define PNG_RGBA 6
+
 typedef struct png_chunk_header
 {
     uint32_t length;
@@ -28,259 +37,894 @@ struct png_metadata_chunk
     uint8_t interlacing;
 };
 
-struct png_24bpp
+// Length of the data of the header chunk, which is shorter than the structure
+// as it isn't padded
+#define PNG_HEADER_LENGTH 13
+
+// Length of a chunk besides its data: the length, type and crc
+#define PNG_CHUNK_OVERHEAD 12
+
+// Length of the zlib header and the Adler-32 trailer around the image data
+#define ZLIB_HEADER_SIZE 2
+#define ZLIB_TRAILER_SIZE 4
+
+// Offset of the pixels within a scanline buffer, which puts them on an 8 byte
+// boundary for the unfilter routines, with the filter byte just before them
+#define ROW_PIXELS 8
+
+// Position of the first pixel in each pass over an interlaced image and the
+// spacing between its pixels, along with the size of the block around each
+// pixel which no earlier pass has filled in
+struct png_pass
+{
+    uint8_t x;
+    uint8_t y;
+    uint8_t dx;
+    uint8_t dy;
+    uint8_t block_width;
+    uint8_t block_height;
+};
+
+#define ADAM7_PASSES 7
+
+static const struct png_pass adam7_passes[ADAM7_PASSES] =
 {
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
+    {.x = 0, .y = 0, .dx = 8, .dy = 8, .block_width = 8, .block_height = 8},
+    {.x = 4, .y = 0, .dx = 8, .dy = 8, .block_width = 4, .block_height = 8},
+    {.x = 0, .y = 4, .dx = 4, .dy = 8, .block_width = 4, .block_height = 4},
+    {.x = 2, .y = 0, .dx = 4, .dy = 4, .block_width = 2, .block_height = 4},
+    {.x = 0, .y = 2, .dx = 2, .dy = 4, .block_width = 2, .block_height = 2},
+    {.x = 1, .y = 0, .dx = 2, .dy = 2, .block_width = 1, .block_height = 2},
+    {.x = 0, .y = 1, .dx = 1, .dy = 2, .block_width = 1, .block_height = 1},
+};
+
+// Images which are not interlaced are a single pass over every pixel
+static const struct png_pass full_pass = {.x = 0, .y = 0, .dx = 1, .dy = 1, .block_width = 1, .block_height = 1};
+
+/*
+    The image data is decompressed as the IDAT chunks are reached, straight
+    into a buffer holding a single scanline. Once a scanline is complete it is
+    unfiltered against the one before it and converted into the image, so
+    besides the image itself only two scanlines are ever held.
+*/
+struct png_decoder
+{
+    // Set once the header has been read
+    bool have_header;
+
+    uint32_t width;
+    uint32_t height;
+    uint8_t bit_depth;
+    uint8_t color_type;
+    size_t channels;
+    bool interlaced;
+
+    // Format the image was asked for in, which it is decoded into if it can be
+    pixel_format requested;
+
+    // Palette entries (from PLTE, with the alpha from tRNS), which are opaque
+    // black if the image refers past the end of the palette
+    struct pixel_rgba32 palette[256];
+    size_t palette_length;
+    bool palette_alpha;
+
+    // For gray and RGB images, the sample values (at full precision) of the
+    // single fully transparent color given by tRNS
+    bool has_key;
+    uint16_t key[3];
+
+    struct inflate_state* inflate;
+
+    // The zlib header and trailer, which may be split across chunks
+    uint8_t header[ZLIB_HEADER_SIZE];
+    uint8_t trailer[ZLIB_TRAILER_SIZE];
+    size_t header_length;
+    size_t trailer_length;
+    bool done;
+
+    // The pass being decoded, which is a reduced image of its own, and set once
+    // every pass is complete
+    size_t pass_index;
+    const struct png_pass* pass;
+    size_t pass_width;
+    size_t pass_height;
+    bool complete;
+
+    // Length of a scanline of the pass without its filter byte, and the
+    // unfilter routines for the size of a pixel, indexed by filter type
+    size_t stride;
+    const unfilter_fn* unfilters;
+
+    // Scanline being decompressed and the previous unfiltered scanline, which
+    // is all zeros above the first one. The row length includes the filter
+    // byte, which is at ROW_PIXELS - 1.
+    uint8_t* row;
+    uint8_t* prev;
+    size_t row_length;
+    size_t row_filled;
+
+    // Scanline within the pass
+    size_t y;
 };
 
 // Process an individual png chunk
-int handle_png_chunk(void** buffer, struct pixel_buffer* data, void** compressed_buffer, size_t* compressed_buffer_size);
+int handle_png_chunk(void** buffer, const void* end, struct pixel_buffer* data, struct png_decoder* decoder);
+
+// Read the sample at the given index of an unfiltered scanline, at its full
+// precision
+static uint16_t read_sample(const uint8_t* row, size_t index, uint8_t bit_depth)
+{
+    if (bit_depth == 8)
+    {
+        return row[index];
+    }
+    else if (bit_depth == 16)
+    {
+        return (row[2 * index] << 8) | row[2 * index + 1];
+    }
+
+    // Samples smaller than a byte are packed from the most significant bit
+    size_t bit = index * bit_depth;
 
-uint8_t paeth_byte(uint8_t a, uint8_t b, uint8_t c)
+    return (row[bit / 8] >> (8 - bit_depth - bit % 8)) & ((1 << bit_depth) - 1);
+}
+
+// Scale a sample to 8 bits
+static uint8_t scale_sample(uint16_t value, uint8_t bit_depth)
 {
-    /*
-     ; a = left, b = above, c = upper left
-        p := a + b - c        ; initial estimate
-        pa := abs(p - a)      ; distances to a, b, c
-        pb := abs(p - b)
-        pc := abs(p - c)
-        ; return nearest of a,b,c,
-        ; breaking ties in order a,b,c.
-        if pa <= pb AND pa <= pc then return a
-        else if pb <= pc then return b
-        else return c
-   end*/
-
-   int32_t p = (int32_t)a + (int32_t)b - (int32_t)c;
-
-   int32_t pa = ABS(p - (int32_t)a);
-   int32_t pb = ABS(p - (int32_t)b);
-   int32_t pc = ABS(p - (int32_t)c);
-
-   if ((pa <= pb) && (pa <= pc))
-   {
-       return a;
-   }
-   else if (pb <= pc)
-   {
-       return b;
-   }
-
-   return c;
+    if (bit_depth == 16)
+    {
+        return value >> 8;
+    }
+
+    return value * 255 / ((1 << bit_depth) - 1);
 }
 
-void paeth(uint8_t* dest, uint8_t* a, uint8_t* b, uint8_t* c, size_t bytes)
+// Whether the image can be decoded straight into the given format, which any
+// image can for the formats with a byte per channel, and gray images can for
+// GRAY8. Alpha is dropped when the format has none.
+static bool direct_format(const struct png_decoder* decoder, pixel_format fmt)
 {
-    for (size_t i = 0; i < bytes; i++)
+    switch (fmt)
     {
-        dest[i] = paeth_byte(a[i], b[i], c[i]);
+        case RGB24:
+        case BGR24:
+        case RGBA32:
+        case BGRA32:
+            return true;
+        case GRAY8:
+            return decoder->color_type == PNG_GRAY || decoder->color_type == PNG_GRAY_ALPHA;
+        default:
+            return false;
     }
 }
 
-// Load a portable network graphic image from a buffer into an image data buffer
-int image_backend_png(void* buffer, struct pixel_buffer* data)
+// Pick the format asked for if the image can be decoded into it directly,
+// otherwise the smallest supported pixel format which holds every color in
+// the image without loss (beyond reducing 16 bit samples to 8 bits)
+static pixel_format output_format(const struct png_decoder* decoder, pixel_format requested)
 {
-    // Verify the buffer is a png file
-    if (memcmp(buffer, "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a", 8) != 0)
+    if (direct_format(decoder, requested))
     {
-        printf("Bad Magic\n");
-        return -1;
+        return requested;
     }
 
-    void* walk = buffer + 8;
+    switch (decoder->color_type)
+    {
+        case PNG_GRAY:
+            return decoder->has_key ? RGBA32 : GRAY8;
+        case PNG_RGB:
+            return decoder->has_key ? RGBA32 : RGB24;
+        case PNG_PALETTE:
+            return decoder->palette_alpha ? RGBA32 : RGB24;
+        default:
+            return RGBA32;
+    }
+}
 
-    void* compressed_buffer = 0;
-    size_t compressed_buffer_size = 0;
+// Read the pixel at the given index of an unfiltered scanline
+static inline struct pixel_rgba32 read_pixel(const struct png_decoder* decoder, const uint8_t* row, size_t x)
+{
+    uint8_t bit_depth = decoder->bit_depth;
+    size_t channels = decoder->channels;
 
-    while (1)
+    if (decoder->color_type == PNG_PALETTE)
     {
-        int result = handle_png_chunk(&walk, data, &compressed_buffer, &compressed_buffer_size);
-        
-        if (result < 0)
+        return decoder->palette[read_sample(row, x, bit_depth)];
+    }
+
+    uint16_t samples[4];
+
+    for (size_t c = 0; c < channels; c++)
+    {
+        samples[c] = read_sample(row, x * channels + c, bit_depth);
+    }
+
+    // Gray images repeat the one sample for every color
+    bool gray = decoder->color_type == PNG_GRAY || decoder->color_type == PNG_GRAY_ALPHA;
+    struct pixel_rgba32 color;
+
+    color.r = scale_sample(samples[0], bit_depth);
+    color.g = gray ? color.r : scale_sample(samples[1], bit_depth);
+    color.b = gray ? color.r : scale_sample(samples[2], bit_depth);
+
+    if (decoder->color_type & PNG_GRAY_ALPHA)
+    {
+        color.a = scale_sample(samples[channels - 1], bit_depth);
+    }
+    else
+    {
+        bool transparent = decoder->has_key && samples[0] == decoder->key[0] && (gray || (samples[1] == decoder->key[1] && samples[2] == decoder->key[2]));
+        color.a = transparent ? 0 : 255;
+    }
+
+    return color;
+}
+
+// Write a pixel in one of the formats which images are decoded into directly
+static inline void store_pixel(uint8_t* out, pixel_format fmt, struct pixel_rgba32 color)
+{
+    if (fmt == GRAY8)
+    {
+        out[0] = color.r;
+    }
+    else if (fmt == RGBA32)
+    {
+        *(struct pixel_rgba32*)out = color;
+    }
+    else
+    {
+        bool bgr = (fmt & ORDER_BGR) != 0;
+
+        out[0] = bgr ? color.b : color.r;
+        out[1] = color.g;
+        out[2] = bgr ? color.r : color.b;
+
+        if (fmt == BGRA32)
         {
-            printf("Bad Chunk\n");
-            return 1;
+            out[3] = color.a;
         }
-        if (result == 0)
+    }
+}
+
+// Convert the pixels of an unfiltered scanline of the current pass into a line
+// of the image
+static inline void emit_pixels(const struct png_decoder* decoder, uint8_t* dest, const uint8_t* row, pixel_format fmt)
+{
+    const struct png_pass* pass = decoder->pass;
+    size_t size = GET_BITS_PER_PIXEL(fmt) / 8;
+    size_t step = pass->dx * size;
+
+    uint8_t* out = dest + pass->x * size;
+
+    // Truecolor images with 8 bit samples are by far the most common, and are
+    // read without going through the samples
+    if (decoder->bit_depth == 8 && !decoder->has_key && (decoder->color_type == PNG_RGB || decoder->color_type == PNG_RGBA))
+    {
+        size_t channels = decoder->channels;
+
+        for (size_t x = 0; x < decoder->pass_width; x++)
         {
+            struct pixel_rgba32 color = {.r = row[0], .g = row[1], .b = row[2], .a = channels == 4 ? row[3] : 255};
+
+            store_pixel(out, fmt, color);
+
+            out += step;
+            row += channels;
+        }
+
+        return;
+    }
+
+    for (size_t x = 0; x < decoder->pass_width; x++)
+    {
+        store_pixel(out, fmt, read_pixel(decoder, row, x));
+        out += step;
+    }
+}
+
+// Convert an unfiltered scanline of the current pass into the image
+static void emit_row(const struct png_decoder* decoder, struct pixel_buffer* data, const uint8_t* row)
+{
+    const struct png_pass* pass = decoder->pass;
+    uint8_t* dest = data->raw_buffer + (pass->y + decoder->y * pass->dy) * data->line_length / 8;
+
+    // The usual layouts may already be in the output format
+    bool same_layout = (decoder->color_type == PNG_GRAY && data->fmt == GRAY8) || (decoder->color_type == PNG_RGB && data->fmt == RGB24) || (decoder->color_type == PNG_RGBA && data->fmt == RGBA32);
+
+    if (pass->dx == 1 && decoder->bit_depth == 8 && same_layout)
+    {
+        memcpy(dest, row, decoder->stride);
+        return;
+    }
+
+    switch (data->fmt)
+    {
+        case GRAY8:
+            emit_pixels(decoder, dest, row, GRAY8);
+            break;
+        case RGB24:
+            emit_pixels(decoder, dest, row, RGB24);
             break;
+        case BGR24:
+            emit_pixels(decoder, dest, row, BGR24);
+            break;
+        case RGBA32:
+            emit_pixels(decoder, dest, row, RGBA32);
+            break;
+        case BGRA32:
+            emit_pixels(decoder, dest, row, BGRA32);
+            break;
+    }
+}
+
+// Spread each pixel of the scanline just written over the block around it
+// which later passes have yet to fill in, so a partly loaded interlaced image
+// can be shown as a coarse preview. No earlier pass has written anything
+// within those blocks, so nothing decoded is overwritten.
+static void fill_blocks(const struct png_decoder* decoder, struct pixel_buffer* data)
+{
+    const struct png_pass* pass = decoder->pass;
+    size_t size = GET_BITS_PER_PIXEL(data->fmt) / 8;
+    size_t line = data->line_length / 8;
+    size_t y = pass->y + decoder->y * pass->dy;
+
+    uint8_t* dest = data->raw_buffer + y * line;
+
+    for (size_t x = pass->x; x < data->width; x += pass->dx)
+    {
+        for (size_t i = 1; i < pass->block_width && x + i < data->width; i++)
+        {
+            memcpy(dest + (x + i) * size, dest + x * size, size);
+        }
+    }
+
+    for (size_t i = 1; i < pass->block_height && y + i < data->height; i++)
+    {
+        memcpy(dest + i * line, dest, line);
+    }
+}
+
+// Move on to the next pass which has any pixels in it, or mark the image as
+// complete if there are none left
+static void start_pass(struct png_decoder* decoder)
+{
+    size_t passes = decoder->interlaced ? ADAM7_PASSES : 1;
+
+    for (; decoder->pass_index < passes; decoder->pass_index++)
+    {
+        const struct png_pass* pass = decoder->interlaced ? &adam7_passes[decoder->pass_index] : &full_pass;
+
+        // Small images can have passes with no pixels, which are left out
+        if (decoder->width <= pass->x || decoder->height <= pass->y)
+        {
+            continue;
+        }
+
+        decoder->pass = pass;
+        decoder->pass_width = (decoder->width - pass->x + pass->dx - 1) / pass->dx;
+        decoder->pass_height = (decoder->height - pass->y + pass->dy - 1) / pass->dy;
+        decoder->stride = (decoder->pass_width * decoder->channels * decoder->bit_depth + 7) / 8;
+        decoder->row_length = decoder->stride + 1;
+        decoder->y = 0;
+
+        // Each pass is filtered on its own, starting from a row of zeros
+        memset(decoder->prev, 0, ROW_PIXELS + decoder->stride);
+
+        return;
+    }
+
+    decoder->complete = true;
+}
+
+// Allocate the image, the scanline buffers and the decompression state once
+// every chunk which affects the output format has been seen, returns 0 on
+// success and -1 on failure
+static int png_decoder_init(struct png_decoder* decoder, struct pixel_buffer* data)
+{
+    if (!decoder->have_header)
+    {
+        return -1;
+    }
+
+    if (decoder->color_type == PNG_PALETTE && decoder->palette_length == 0)
+    {
+        printf("Missing palette\n");
+        return -1;
+    }
+
+    // The scanlines of every pass fit in buffers for a full width scanline
+    size_t bits = decoder->channels * decoder->bit_depth;
+    size_t stride = ((size_t)decoder->width * bits + 7) / 8;
+
+    decoder->unfilters = unfilter_routines(bits < 8 ? 1 : bits / 8);
+
+    *data = alloc_pixel_buffer(output_format(decoder, decoder->requested), decoder->width, decoder->height);
+
+    decoder->row = malloc(ROW_PIXELS + stride);
+    decoder->prev = malloc(ROW_PIXELS + stride);
+    decoder->inflate = inflate_init();
+
+    if (data->raw_buffer == NULL || decoder->row == NULL || decoder->prev == NULL || decoder->inflate == NULL)
+    {
+        return -1;
+    }
+
+    start_pass(decoder);
+
+    if (image_checksums_enabled)
+    {
+        inflate_set_check(decoder->inflate, INFLATE_CHECK_ADLER32);
+    }
+
+    return 0;
+}
+
+// Free everything held by the decoder
+static void png_decoder_end(struct png_decoder* decoder)
+{
+    if (decoder->inflate != NULL)
+    {
+        inflate_end(decoder->inflate);
+    }
+
+    free(decoder->row);
+    free(decoder->prev);
+}
+
+// Unfilter the completed scanline and convert it into the image, returns 0 on
+// success and -1 on failure
+static int finish_row(struct png_decoder* decoder, struct pixel_buffer* data)
+{
+    uint8_t filter_type = decoder->row[ROW_PIXELS - 1];
+    uint8_t* pixels = decoder->row + ROW_PIXELS;
+
+    if (filter_type >= PNG_FILTERS)
+    {
+        printf("Invalid filter type %i\n", filter_type);
+        return -1;
+    }
+
+    if (filter_type != 0)
+    {
+        decoder->unfilters[filter_type](pixels, decoder->prev + ROW_PIXELS, decoder->stride);
+    }
+
+    emit_row(decoder, data, pixels);
+
+    if (image_progress != NULL && decoder->interlaced)
+    {
+        fill_blocks(decoder, data);
+    }
+
+    // The scanline just finished is the one above the next
+    uint8_t* prev = decoder->prev;
+    decoder->prev = decoder->row;
+    decoder->row = prev;
+    decoder->y++;
+
+    if (decoder->y == decoder->pass_height)
+    {
+        int finished = ++decoder->pass_index;
+        start_pass(decoder);
+
+        // The load returns once the final pass is done, so only the passes
+        // before it are reported
+        if (image_progress != NULL && decoder->interlaced && !decoder->complete)
+        {
+            image_progress(data, finished, image_progress_context);
         }
     }
 
-    if (compressed_buffer_size)
+    return 0;
+}
+
+// Feed the contents of an IDAT chunk to the decoder, returns 0 on success and
+// -1 on failure
+static int feed_image_data(struct png_decoder* decoder, struct pixel_buffer* data, const uint8_t* input, size_t length)
+{
+    size_t filled = decoder->row_filled;
+
+    while (length > 0)
     {
-        size_t decompressed_size = 0;
-        void* decompressed = deflate_decompress(compressed_buffer + 2, &decompressed_size);
-        free(compressed_buffer);
+        if (decoder->header_length < ZLIB_HEADER_SIZE)
+        {
+            decoder->header[decoder->header_length++] = *input++;
+            length--;
+
+            // The header must use DEFLATE with at most a 32 KiB window, and no
+            // preset dictionary
+            uint8_t cmf = decoder->header[0];
+            uint8_t flg = decoder->header[1];
+
+            if (decoder->header_length == ZLIB_HEADER_SIZE && ((cmf & 0x0F) != CM_DEFLATE || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20)))
+            {
+                printf("Invalid zlib header\n");
+                return -1;
+            }
+
+            continue;
+        }
+
+        // Anything after the trailer is ignored
+        if (decoder->done)
+        {
+            size_t count = MIN(length, ZLIB_TRAILER_SIZE - decoder->trailer_length);
+
+            memcpy(decoder->trailer + decoder->trailer_length, input, count);
+            decoder->trailer_length += count;
+
+            break;
+        }
+
+        // Once every scanline is complete nothing more should be produced, so
+        // the output only has room to notice if something is
+        uint8_t spare;
+        uint8_t* output = &spare;
+        size_t space = 1;
+
+        if (!decoder->complete)
+        {
+            output = decoder->row + ROW_PIXELS - 1 + filled;
+            space = decoder->row_length - filled;
+        }
+
+        size_t consumed;
+        size_t produced;
 
-        size_t number_bytes = GET_BITS_PER_PIXEL(data->fmt);
+        int status = inflate_feed(decoder->inflate, input, length, &consumed, output, space, &produced);
+        input += consumed;
+        length -= consumed;
 
-        for (size_t y = 0; y < data->height; y++)
+        if (status == INFLATE_ERROR || (produced > 0 && decoder->complete))
         {
-            uint8_t* line_pointer = decompressed + y * (1 + 3 * data->width);
-            struct png_24bpp* dest_line_pointer = data->raw_buffer + y * data->line_length / 8;
-            struct png_24bpp* dest_line_pointer_prev = (void*)dest_line_pointer - data->line_length / 8;
-            uint8_t filter_type = *line_pointer;
-            struct png_24bpp* pixels = (struct png_24bpp*)(line_pointer + 1);
+            printf("Bad Image Data\n");
+            return -1;
+        }
+
+        filled += produced;
 
-            for (size_t x = 0; x < data->width; x++)
+        if (filled == decoder->row_length)
+        {
+            if (finish_row(decoder, data))
             {
-                struct png_24bpp color = pixels[x];
-                
-                if (filter_type == 1)
-                {
-                    if (x > 0)
-                    {
-                        struct png_24bpp last = dest_line_pointer[x - 1];
-                        dest_line_pointer[x] = (struct png_24bpp){.r = last.r + color.r, .g = last.g + color.g, .b = last.b + color.b};
-                    }
-                    else
-                    {
-                        dest_line_pointer[x] = color;
-                    }
-                }
-                else if (filter_type == 2)
-                {
-                    if (y > 0)
-                    {
-                        struct png_24bpp last = dest_line_pointer_prev[x];
-                        dest_line_pointer[x] = (struct png_24bpp){.r = last.r + color.r, .g = last.g + color.g, .b = last.b + color.b};
-                    }
-                    else
-                    {
-                        dest_line_pointer[x] = color;
-                    }
-                }
-                else if (filter_type == 3)
-                {
-                    struct png_24bpp up = (struct png_24bpp){.r = 0, .g = 0, .b = 0};
-                    struct png_24bpp left = (struct png_24bpp){.r = 0, .g = 0, .b = 0};
-
-                    if (y > 0)
-                    {
-                        up = dest_line_pointer_prev[x];
-                    }
-                    if (x > 0)
-                    {
-                        left = dest_line_pointer[x - 1];
-                    }
-
-                    dest_line_pointer[x] = (struct png_24bpp){.r = (up.r + left.r) / 2 + color.r, .g = (up.g + left.g) / 2 + color.g, .b = (up.b + left.b) / 2 + color.b};
-                }
-                else if (filter_type == 4)
-                {
-                    struct png_24bpp up = (struct png_24bpp){.r = 0, .g = 0, .b = 0};
-                    struct png_24bpp left = (struct png_24bpp){.r = 0, .g = 0, .b = 0};
-                    struct png_24bpp up_left = (struct png_24bpp){.r = 0, .g = 0, .b = 0};
-
-                    if (y > 0)
-                    {
-                        up = dest_line_pointer_prev[x];
-                    }
-                    if (x > 0)
-                    {
-                        left = dest_line_pointer[x - 1];
-                    }
-                    if (x > 0 && y > 0)
-                    {
-                        up_left = dest_line_pointer_prev[x - 1];
-                    }
-
-                    struct png_24bpp last;
-                    paeth((uint8_t*)&last, (uint8_t*)&left, (uint8_t*)&up, (uint8_t*)&up_left, 3);
-                    dest_line_pointer[x] = (struct png_24bpp){.r = last.r + color.r, .g = last.g + color.g, .b = last.b + color.b};
-                }
-                else
-                {
-                    dest_line_pointer[x] = color;
-                }
+                return -1;
             }
+
+            filled = 0;
         }
+
+        decoder->done = status == INFLATE_DONE;
+    }
+
+    decoder->row_filled = filled;
+
+    return 0;
+}
+
+// Adler-32 stored in the zlib trailer
+static uint32_t png_trailer_value(const struct png_decoder* decoder)
+{
+    const uint8_t* t = decoder->trailer;
+
+    return ((uint32_t)t[0] << 24) | (t[1] << 16) | (t[2] << 8) | t[3];
+}
+
+// Load a portable network graphic image from a buffer of the given length
+// into an image data buffer, decoding it straight into the given format where
+// possible and otherwise into the format closest to the image's own
+int image_backend_png(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt)
+{
+    // Verify the buffer is a png file
+    if (length < 8 || memcmp(buffer, "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a", 8) != 0)
+    {
+        printf("Bad Magic\n");
+        return -1;
+    }
+
+    void* walk = buffer + 8;
+
+    struct png_decoder decoder = {0};
+    decoder.requested = fmt;
+    data->raw_buffer = NULL;
+
+    int result;
+
+    while ((result = handle_png_chunk(&walk, buffer + length, data, &decoder)) > 0);
+
+    if (result < 0)
+    {
+        printf("Bad Chunk\n");
+    }
+    else if (decoder.inflate == NULL || !decoder.complete || decoder.trailer_length != ZLIB_TRAILER_SIZE)
+    {
+        printf("Bad Image Data\n");
+        result = -1;
+    }
+    else if (image_checksums_enabled && png_trailer_value(&decoder) != inflate_check_value(decoder.inflate))
+    {
+        printf("zlib checksum mismatch\n");
+        result = -1;
+    }
+
+    png_decoder_end(&decoder);
+
+    if (result < 0)
+    {
+        free(data->raw_buffer);
+        data->raw_buffer = NULL;
+        return -1;
     }
 
     return 0;
 }
 
 // Handle a metadata chunk
-int handle_metadata_chunk(void* buffer, struct pixel_buffer* data)
+int handle_metadata_chunk(void* buffer, struct png_decoder* decoder)
 {
     struct png_metadata_chunk* chunk_data = buffer;
 
-    // Make sure we are in a supported format, for right now just a bitDepth of 8, true color, filter set 0, and no interlacing
-    if (chunk_data->bit_depth != 8)
+    uint8_t bit_depth = chunk_data->bit_depth;
+    uint8_t color_type = chunk_data->color_type;
+
+    // Palette images have at most 8 bits per index, gray images may have
+    // fewer than 8 bits per sample, and anything else has 8 or 16
+    bool valid_depth;
+
+    switch (color_type)
     {
-        printf("Invalid bit depth of %i \n", chunk_data->bit_depth);
-        assert(0);
+        case PNG_GRAY:
+            valid_depth = bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+            break;
+        case PNG_PALETTE:
+            valid_depth = bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+            break;
+        case PNG_RGB:
+        case PNG_GRAY_ALPHA:
+        case PNG_RGBA:
+            valid_depth = bit_depth == 8 || bit_depth == 16;
+            break;
+        default:
+            printf("Invalid color type of %i \n", color_type);
+            return -1;
+    }
+
+    if (!valid_depth)
+    {
+        printf("Invalid bit depth of %i \n", bit_depth);
+        return -1;
     }
 
-    if (chunk_data->color_type != 2)
+    if (chunk_data->compression != 0)
     {
-        printf("Invalid color type of %i \n", chunk_data->color_type);
-        assert(0);
+        printf("Invalid compression method %i \n", chunk_data->compression);
+        return -1;
     }
 
     if (chunk_data->filter_method != 0)
     {
         printf("Invalid filter set of %i \n", chunk_data->filter_method);
-        assert(0);
+        return -1;
     }
 
-    if (chunk_data->interlacing != 0)
+    if (chunk_data->interlacing > 1)
     {
         printf("Invalid interlacing value %i \n", chunk_data->interlacing);
-        assert(0);
+        return -1;
+    }
+
+    if (chunk_data->width == 0 || chunk_data->height == 0)
+    {
+        printf("Invalid image size\n");
+        return -1;
+    }
+
+    decoder->width = BIG_ENDIAN32(chunk_data->width);
+    decoder->height = BIG_ENDIAN32(chunk_data->height);
+    decoder->bit_depth = bit_depth;
+    decoder->color_type = color_type;
+    decoder->interlaced = chunk_data->interlacing == 1;
+    decoder->channels = color_type == PNG_RGB ? 3 : color_type == PNG_GRAY_ALPHA ? 2 : color_type == PNG_RGBA ? 4 : 1;
+    decoder->have_header = true;
+
+    return 0;
+}
+
+// Handle a palette chunk
+int handle_palette_chunk(uint8_t* buffer, size_t length, struct png_decoder* decoder)
+{
+    if (length % 3 != 0 || length / 3 > 256)
+    {
+        printf("Invalid palette length %lu\n", length);
+        return -1;
     }
 
-    *data = alloc_pixel_buffer(RGB24, (size_t)BIG_ENDIAN32(chunk_data->width), (size_t)BIG_ENDIAN32(chunk_data->height));
+    decoder->palette_length = length / 3;
+
+    for (size_t i = 0; i < decoder->palette_length; i++)
+    {
+        decoder->palette[i] = (struct pixel_rgba32){.r = buffer[3 * i], .g = buffer[3 * i + 1], .b = buffer[3 * i + 2], .a = 255};
+    }
+
+    for (size_t i = decoder->palette_length; i < 256; i++)
+    {
+        decoder->palette[i] = (struct pixel_rgba32){.r = 0, .g = 0, .b = 0, .a = 255};
+    }
 
     return 0;
 }
 
-// Handle a data chunk
-int handle_data_chunk(void* buffer, struct pixel_buffer* data, size_t length, void** compressed_buffer, size_t* compressed_buffer_size)
+// Handle a transparency chunk, which gives the alpha of each palette entry or
+// a single color which is fully transparent
+int handle_transparency_chunk(uint8_t* buffer, size_t length, struct png_decoder* decoder)
 {
-    void* new_buffer = malloc(*compressed_buffer_size + length);
-    if (*compressed_buffer_size != 0)
+    if (decoder->color_type == PNG_PALETTE)
     {
-        memcpy(new_buffer, *compressed_buffer, *compressed_buffer_size);
+        if (length > decoder->palette_length)
+        {
+            printf("Invalid transparency length %lu\n", length);
+            return -1;
+        }
+
+        for (size_t i = 0; i < length; i++)
+        {
+            decoder->palette[i].a = buffer[i];
+        }
+
+        decoder->palette_alpha = length > 0;
+    }
+    else if (decoder->color_type == PNG_GRAY || decoder->color_type == PNG_RGB)
+    {
+        if (length != 2 * decoder->channels)
+        {
+            printf("Invalid transparency length %lu\n", length);
+            return -1;
+        }
+
+        for (size_t i = 0; i < decoder->channels; i++)
+        {
+            decoder->key[i] = (buffer[2 * i] << 8) | buffer[2 * i + 1];
+        }
+
+        decoder->has_key = true;
     }
 
-    memcpy(new_buffer + *compressed_buffer_size, buffer, length);
+    return 0;
+}
 
-    if (*compressed_buffer_size != 0)
+// Check the crc of a chunk with the given length of data, which covers the
+// chunk type and data and is checked before the chunk is used. Always passes
+// when checksums are turned off.
+static bool chunk_crc_valid(const png_chunk_header* header, size_t len)
+{
+    if (!image_checksums_enabled)
     {
-        free(*compressed_buffer);
+        return true;
     }
 
-    *compressed_buffer = new_buffer;
-    *compressed_buffer_size += length;
+    uint32_t crc;
+    memcpy(&crc, &header->data + len, 4);
 
-    return 1;
+    return crc32_update(0, header->type, len + 4) == BIG_ENDIAN32(crc);
 }
 
 // Process an individual png chunk
-int handle_png_chunk(void** buffer, struct pixel_buffer* data, void** compressed_buffer, size_t* compressed_buffer_size)
+int handle_png_chunk(void** buffer, const void* end, struct pixel_buffer* data, struct png_decoder* decoder)
 {
     // Extract the header and data
     png_chunk_header* header = *buffer;
     void* buffer_data = *buffer + 8;
 
+    // The whole chunk must be within the file, as it is read straight from it
+    size_t remaining = end - *buffer;
+
+    if (remaining < PNG_CHUNK_OVERHEAD)
+    {
+        printf("Truncated chunk\n");
+        return -1;
+    }
+
     // Get the size of the chunk (properly)
     size_t len = BIG_ENDIAN32(header->length);
-    // Handle the metadata chunk
+
+    if (len > remaining - PNG_CHUNK_OVERHEAD)
+    {
+        printf("Truncated chunk\n");
+        return -1;
+    }
+
+    if (!chunk_crc_valid(header, len))
+    {
+        printf("Chunk crc mismatch\n");
+        return -1;
+    }
+
+    // The header must come first, and the chunks describing the colors must
+    // come before the image data, as they decide the output format
     if (memcmp(header->type, "IHDR", 4) == 0)
     {
-        handle_metadata_chunk(buffer_data, data);
+        if (decoder->have_header || len < PNG_HEADER_LENGTH || handle_metadata_chunk(buffer_data, decoder))
+        {
+            return -1;
+        }
+    }
+    else if (!decoder->have_header)
+    {
+        printf("Missing header\n");
+        return -1;
+    }
+    else if (memcmp(header->type, "PLTE", 4) == 0 && decoder->inflate == NULL)
+    {
+        if (handle_palette_chunk(buffer_data, len, decoder))
+        {
+            return -1;
+        }
+    }
+    else if (memcmp(header->type, "tRNS", 4) == 0 && decoder->inflate == NULL)
+    {
+        if (handle_transparency_chunk(buffer_data, len, decoder))
+        {
+            return -1;
+        }
     }
     else if (memcmp(header->type, "IDAT", 4) == 0)
     {
-        handle_data_chunk(buffer_data, data, len, compressed_buffer, compressed_buffer_size);
+        if (decoder->inflate == NULL && png_decoder_init(decoder, data))
+        {
+            return -1;
+        }
+
+        if (feed_image_data(decoder, data, buffer_data, len))
+        {
+            return -1;
+        }
     }
 
     // Move the buffer along to ahead of the next chunk
     *buffer = buffer_data + len;
     *buffer += 4;
     return memcmp(header->type, "IEND", 4) == 0 ? 0 : 1;
-}
\ No newline at end of file
+}
+
+// Read the size and layout of a portable network graphic from the start of a
+// file, which must hold at least the signature and the header chunk. Nothing
+// past the header is read, so the format is the one the image decodes to
+// without a tRNS chunk, which would make it RGBA32. Returns 0 on success and
+// -1 on failure.
+int image_probe_png(void* buffer, size_t length, struct image_info* info)
+{
+    if (length < 8 || memcmp(buffer, "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a", 8) != 0)
+    {
+        printf("Bad Magic\n");
+        return -1;
+    }
+
+    png_chunk_header* header = buffer + 8;
+
+    if (length < 8 + PNG_CHUNK_OVERHEAD + PNG_HEADER_LENGTH || memcmp(header->type, "IHDR", 4) != 0 || BIG_ENDIAN32(header->length) != PNG_HEADER_LENGTH)
+    {
+        printf("Missing header\n");
+        return -1;
+    }
+
+    if (!chunk_crc_valid(header, PNG_HEADER_LENGTH))
+    {
+        printf("Chunk crc mismatch\n");
+        return -1;
+    }
+
+    struct png_decoder decoder = {0};
+
+    if (handle_metadata_chunk((void*)&header->data, &decoder))
+    {
+        return -1;
+    }
+
+    info->width = decoder.width;
+    info->height = decoder.height;
+    info->fmt = output_format(&decoder, 0);
+    info->bit_depth = decoder.bit_depth;
+    info->interlaced = decoder.interlaced;
+
+    return 0;
+}
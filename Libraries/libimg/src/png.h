@@ -3,7 +3,23 @@
 
 #include "libimg.h"
 
-// Load a portable network graphic image from a buffer into an image data buffer
-int image_backend_png(void* buffer, struct pixel_buffer* data);
+// Whether stored checksums are verified, set by image_verify_checksums
+extern bool image_checksums_enabled;
+
+// Called after each pass of an interlaced image, set by image_progress_callback
+extern image_progress_fn image_progress;
+extern void* image_progress_context;
+
+// Load a portable network graphic image from a buffer of the given length
+// into an image data buffer, decoding it straight into the given format where
+// possible and otherwise into the format closest to the image's own
+int image_backend_png(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt);
+
+// Read the size and layout of a portable network graphic from the start of a
+// file, which must hold at least the signature and the header chunk. Nothing
+// past the header is read, so the format is the one the image decodes to
+// without a tRNS chunk, which would make it RGBA32. Returns 0 on success and
+// -1 on failure.
+int image_probe_png(void* buffer, size_t length, struct image_info* info);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,447 @@
+#include "libimg.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "graphics.h"
+
+#include "qoi.h"
+
+/*
+    A quite ok image is a stream of pixels, each given as a run of the pixel
+    before it, an entry in a table of the 64 pixels seen most recently (by
+    hash), a small difference from the pixel before it, or in full. Every
+    pixel is a byte or two, and decoding one takes no more than a few adds,
+    so decoding is far quicker than a png with little loss in size.
+
+    Rows of an image follow each other directly, so both the decoder and the
+    encoder treat the image as a single row.
+*/
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+
+#define QOI_OP_MASK 0xC0
+
+// Longest run a single op can hold, as 63 and 64 would be the rgb and rgba ops
+#define QOI_MAX_RUN 62
+
+// Images with more pixels than this are refused, so a bad header can't ask for
+// an enormous buffer
+#define QOI_MAX_PIXELS 400000000
+
+static const uint8_t qoi_padding[QOI_PADDING_SIZE] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// Position of a pixel in the table of recent pixels
+static inline size_t qoi_hash(struct pixel_rgba32 pixel)
+{
+    return (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+}
+
+static inline bool same_pixel(struct pixel_rgba32 a, struct pixel_rgba32 b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static inline uint32_t read_big_endian(const uint8_t* bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+static inline void write_big_endian(uint8_t* bytes, uint32_t value)
+{
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+// Check the header of an image, returns 0 if it can be decoded and -1 if not
+static int check_header(const uint8_t* buffer, size_t length)
+{
+    if (length < QOI_HEADER_SIZE || memcmp(buffer, "qoif", 4) != 0)
+    {
+        return -1;
+    }
+
+    uint32_t width = read_big_endian(buffer + 4);
+    uint32_t height = read_big_endian(buffer + 8);
+    uint8_t channels = buffer[12];
+
+    if (width == 0 || height == 0 || height > QOI_MAX_PIXELS / width)
+    {
+        printf("Invalid image size\n");
+        return -1;
+    }
+
+    if (channels != 3 && channels != 4)
+    {
+        printf("Invalid channel count %i\n", channels);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Write a pixel in one of the formats which images are decoded into directly
+static inline void store_pixel(uint8_t* out, pixel_format fmt, struct pixel_rgba32 pixel)
+{
+    if (fmt == RGBA32)
+    {
+        *(struct pixel_rgba32*)out = pixel;
+        return;
+    }
+
+    bool bgr = (fmt & ORDER_BGR) != 0;
+
+    out[0] = bgr ? pixel.b : pixel.r;
+    out[1] = pixel.g;
+    out[2] = bgr ? pixel.r : pixel.b;
+
+    if (fmt == BGRA32)
+    {
+        out[3] = pixel.a;
+    }
+}
+
+// Read a pixel in one of the formats which images are encoded from directly
+static inline struct pixel_rgba32 load_pixel(const uint8_t* in, pixel_format fmt)
+{
+    if (fmt == RGBA32)
+    {
+        return *(const struct pixel_rgba32*)in;
+    }
+
+    bool bgr = (fmt & ORDER_BGR) != 0;
+    struct pixel_rgba32 pixel;
+
+    pixel.r = bgr ? in[2] : in[0];
+    pixel.g = in[1];
+    pixel.b = bgr ? in[0] : in[2];
+    pixel.a = fmt == BGRA32 ? in[3] : 255;
+
+    return pixel;
+}
+
+// Decode count pixels from the ops between input and end into the image,
+// returns 0 on success and -1 if the ops run out first
+static inline int decode_pixels(const uint8_t* input, const uint8_t* end, uint8_t* out, size_t count, pixel_format fmt)
+{
+    size_t size = GET_BITS_PER_PIXEL(fmt) / 8;
+
+    struct pixel_rgba32 index[64];
+    memset(index, 0, sizeof(index));
+
+    struct pixel_rgba32 pixel = {.r = 0, .g = 0, .b = 0, .a = 255};
+    size_t run = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (run > 0)
+        {
+            run--;
+        }
+        else
+        {
+            // The padding after the ops is longer than any op, so a whole op
+            // can always be read from before the end
+            if (input >= end)
+            {
+                return -1;
+            }
+
+            uint8_t op = *input++;
+
+            if (op == QOI_OP_RGB)
+            {
+                pixel.r = input[0];
+                pixel.g = input[1];
+                pixel.b = input[2];
+                input += 3;
+            }
+            else if (op == QOI_OP_RGBA)
+            {
+                pixel.r = input[0];
+                pixel.g = input[1];
+                pixel.b = input[2];
+                pixel.a = input[3];
+                input += 4;
+            }
+            else if ((op & QOI_OP_MASK) == QOI_OP_INDEX)
+            {
+                pixel = index[op];
+            }
+            else if ((op & QOI_OP_MASK) == QOI_OP_DIFF)
+            {
+                pixel.r += ((op >> 4) & 3) - 2;
+                pixel.g += ((op >> 2) & 3) - 2;
+                pixel.b += (op & 3) - 2;
+            }
+            else if ((op & QOI_OP_MASK) == QOI_OP_LUMA)
+            {
+                uint8_t next = *input++;
+                int green = (op & 0x3F) - 32;
+
+                pixel.r += green - 8 + (next >> 4);
+                pixel.g += green;
+                pixel.b += green - 8 + (next & 0x0F);
+            }
+            else
+            {
+                run = op & 0x3F;
+            }
+
+            index[qoi_hash(pixel)] = pixel;
+        }
+
+        store_pixel(out, fmt, pixel);
+        out += size;
+    }
+
+    return 0;
+}
+
+// Load a quite ok image from a buffer of the given length into an image data
+// buffer, decoding it straight into the given format if it is one of the 24
+// or 32 bit color formats, and otherwise into RGBA32 or RGB24 (whichever the
+// image is stored as)
+int image_backend_qoi(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt)
+{
+    const uint8_t* bytes = buffer;
+
+    if (check_header(bytes, length) || length < QOI_HEADER_SIZE + QOI_PADDING_SIZE)
+    {
+        return -1;
+    }
+
+    if (fmt != RGBA32 && fmt != RGB24 && fmt != BGRA32 && fmt != BGR24)
+    {
+        fmt = bytes[12] == 4 ? RGBA32 : RGB24;
+    }
+
+    *data = alloc_pixel_buffer(fmt, read_big_endian(bytes + 4), read_big_endian(bytes + 8));
+
+    if (data->raw_buffer == NULL)
+    {
+        return -1;
+    }
+
+    const uint8_t* input = bytes + QOI_HEADER_SIZE;
+    const uint8_t* end = bytes + length - QOI_PADDING_SIZE;
+    size_t count = data->width * data->height;
+    int result = -1;
+
+    switch (fmt)
+    {
+        case RGBA32:
+            result = decode_pixels(input, end, data->raw_buffer, count, RGBA32);
+            break;
+        case RGB24:
+            result = decode_pixels(input, end, data->raw_buffer, count, RGB24);
+            break;
+        case BGRA32:
+            result = decode_pixels(input, end, data->raw_buffer, count, BGRA32);
+            break;
+        case BGR24:
+            result = decode_pixels(input, end, data->raw_buffer, count, BGR24);
+            break;
+    }
+
+    if (result)
+    {
+        printf("Truncated image data\n");
+        free_pixel_buffer(*data);
+        data->raw_buffer = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Read the size and layout of a quite ok image from the start of a file, which
+// must hold at least the header. Returns 0 on success and -1 on failure.
+int image_probe_qoi(void* buffer, size_t length, struct image_info* info)
+{
+    const uint8_t* bytes = buffer;
+
+    if (check_header(bytes, length))
+    {
+        return -1;
+    }
+
+    info->width = read_big_endian(bytes + 4);
+    info->height = read_big_endian(bytes + 8);
+    info->fmt = bytes[12] == 4 ? RGBA32 : RGB24;
+    info->bit_depth = 8;
+    info->interlaced = false;
+
+    return 0;
+}
+
+// Encode the pixels of an image as ops, returns the end of the ops
+static inline uint8_t* encode_pixels(const struct pixel_buffer* data, uint8_t* output, pixel_format fmt)
+{
+    size_t size = GET_BITS_PER_PIXEL(fmt) / 8;
+
+    struct pixel_rgba32 index[64];
+    memset(index, 0, sizeof(index));
+
+    struct pixel_rgba32 prev = {.r = 0, .g = 0, .b = 0, .a = 255};
+    size_t run = 0;
+
+    for (size_t y = 0; y < data->height; y++)
+    {
+        const uint8_t* in = data->raw_buffer + y * data->line_length / 8;
+
+        for (size_t x = 0; x < data->width; x++, in += size)
+        {
+            struct pixel_rgba32 pixel = load_pixel(in, fmt);
+
+            if (same_pixel(pixel, prev))
+            {
+                if (++run == QOI_MAX_RUN)
+                {
+                    *output++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+
+                continue;
+            }
+
+            if (run > 0)
+            {
+                *output++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            size_t hash = qoi_hash(pixel);
+
+            if (same_pixel(index[hash], pixel))
+            {
+                *output++ = QOI_OP_INDEX | hash;
+            }
+            else if (pixel.a == prev.a)
+            {
+                index[hash] = pixel;
+
+                int8_t red = pixel.r - prev.r;
+                int8_t green = pixel.g - prev.g;
+                int8_t blue = pixel.b - prev.b;
+
+                int8_t red_green = red - green;
+                int8_t blue_green = blue - green;
+
+                if (red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 && blue <= 1)
+                {
+                    *output++ = QOI_OP_DIFF | ((red + 2) << 4) | ((green + 2) << 2) | (blue + 2);
+                }
+                else if (green >= -32 && green <= 31 && red_green >= -8 && red_green <= 7 && blue_green >= -8 && blue_green <= 7)
+                {
+                    *output++ = QOI_OP_LUMA | (green + 32);
+                    *output++ = ((red_green + 8) << 4) | (blue_green + 8);
+                }
+                else
+                {
+                    *output++ = QOI_OP_RGB;
+                    *output++ = pixel.r;
+                    *output++ = pixel.g;
+                    *output++ = pixel.b;
+                }
+            }
+            else
+            {
+                index[hash] = pixel;
+
+                *output++ = QOI_OP_RGBA;
+                *output++ = pixel.r;
+                *output++ = pixel.g;
+                *output++ = pixel.b;
+                *output++ = pixel.a;
+            }
+
+            prev = pixel;
+        }
+    }
+
+    if (run > 0)
+    {
+        *output++ = QOI_OP_RUN | (run - 1);
+    }
+
+    return output;
+}
+
+// Encode an image as a quite ok image, returning a buffer holding it which
+// can later be free()ed and storing its length, or a null pointer on failure
+void* qoi_encode(struct pixel_buffer* data, size_t* length)
+{
+    pixel_format fmt = data->fmt;
+
+    if (data->width == 0 || data->height == 0 || data->height > QOI_MAX_PIXELS / data->width)
+    {
+        return NULL;
+    }
+
+    // Other formats are converted to RGBA32 first
+    if (fmt != RGBA32 && fmt != RGB24 && fmt != BGRA32 && fmt != BGR24)
+    {
+        struct pixel_buffer converted;
+
+        if (convert_pixel_buffer(RGBA32, &converted, data))
+        {
+            return NULL;
+        }
+
+        void* result = qoi_encode(&converted, length);
+        free_pixel_buffer(converted);
+
+        return result;
+    }
+
+    uint8_t channels = GET_NUM_CHANNELS(fmt);
+
+    // Every pixel takes at most an op byte followed by each channel
+    uint8_t* buffer = malloc(QOI_HEADER_SIZE + data->width * data->height * (channels + 1) + QOI_PADDING_SIZE);
+
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(buffer, "qoif", 4);
+    write_big_endian(buffer + 4, data->width);
+    write_big_endian(buffer + 8, data->height);
+    buffer[12] = channels;
+    buffer[13] = 0;
+
+    uint8_t* end = NULL;
+
+    switch (fmt)
+    {
+        case RGBA32:
+            end = encode_pixels(data, buffer + QOI_HEADER_SIZE, RGBA32);
+            break;
+        case RGB24:
+            end = encode_pixels(data, buffer + QOI_HEADER_SIZE, RGB24);
+            break;
+        case BGRA32:
+            end = encode_pixels(data, buffer + QOI_HEADER_SIZE, BGRA32);
+            break;
+        case BGR24:
+            end = encode_pixels(data, buffer + QOI_HEADER_SIZE, BGR24);
+            break;
+    }
+
+    memcpy(end, qoi_padding, QOI_PADDING_SIZE);
+    *length = end + QOI_PADDING_SIZE - buffer;
+
+    return buffer;
+}
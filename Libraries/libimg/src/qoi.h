@@ -0,0 +1,20 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include "libimg.h"
+
+// Load a quite ok image from a buffer of the given length into an image data
+// buffer, decoding it straight into the given format if it is one of the 24
+// or 32 bit color formats, and otherwise into RGBA32 or RGB24 (whichever the
+// image is stored as)
+int image_backend_qoi(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt);
+
+// Read the size and layout of a quite ok image from the start of a file, which
+// must hold at least the header. Returns 0 on success and -1 on failure.
+int image_probe_qoi(void* buffer, size_t length, struct image_info* info);
+
+// Encode an image as a quite ok image, returning a buffer holding it which
+// can later be free()ed and storing its length, or a null pointer on failure
+void* qoi_encode(struct pixel_buffer* data, size_t* length);
+
+#endif // QOI_H
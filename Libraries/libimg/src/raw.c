@@ -0,0 +1,155 @@
+#include "libimg.h"
+
+#include <libc/stdio.h>
+#include <libc/string.h>
+
+#include "graphics.h"
+
+#include "raw.h"
+
+/*
+    A raw image is a pixel buffer written out as it is held in memory, so it
+    takes no decoding at all. Once the file is mapped the pixel buffer points
+    straight into the mapping.
+*/
+
+// Point a pixel buffer at the pixels of a raw image held in a buffer of the
+// given length, without copying them. Returns 0 on success and -1 on failure.
+int raw_image_view(void* buffer, size_t length, struct pixel_buffer* data)
+{
+    const struct raw_image_header* header = buffer;
+
+    if (length < sizeof(struct raw_image_header) || memcmp(header->magic, RAW_IMAGE_MAGIC, 4) != 0)
+    {
+        return -1;
+    }
+
+    // The format must fit in a pixel_format, and describe both a size and the
+    // channels of a pixel
+    size_t bits = GET_BITS_PER_PIXEL(header->fmt);
+
+    if (header->fmt > 0xFF || bits == 0 || GET_NUM_CHANNELS(header->fmt) == 0 || header->width == 0 || header->height == 0 || (size_t)header->stride * 8 < header->width * bits)
+    {
+        printf("Invalid raw image\n");
+        return -1;
+    }
+
+    // Every row must be within the file, as the pixels are used where they are
+    if (header->offset < sizeof(struct raw_image_header) || header->offset > length || (length - header->offset) / header->stride < header->height)
+    {
+        printf("Truncated raw image\n");
+        return -1;
+    }
+
+    data->fmt = header->fmt;
+    data->width = header->width;
+    data->height = header->height;
+    data->line_length = (size_t)header->stride * 8;
+    data->raw_buffer = buffer + header->offset;
+
+    return 0;
+}
+
+// Write a pixel buffer to a file as a raw image, returns 0 on success and -1
+// on failure
+int raw_image_write(const char* filename, const struct pixel_buffer* data)
+{
+    // Rows are written whole, so each must start on a byte
+    if (data->line_length % 8 != 0)
+    {
+        return -1;
+    }
+
+    uint8_t header[RAW_IMAGE_DATA_OFFSET] = {0};
+
+    struct raw_image_header fields = (struct raw_image_header){.fmt = data->fmt, .width = data->width, .height = data->height, .stride = data->line_length / 8, .offset = RAW_IMAGE_DATA_OFFSET};
+    memcpy(fields.magic, RAW_IMAGE_MAGIC, 4);
+    memcpy(header, &fields, sizeof(fields));
+
+    FILE* file = fopen(filename, "wb");
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    size_t length = fields.stride * data->height;
+    bool written = fwrite(header, 1, RAW_IMAGE_DATA_OFFSET, file) == RAW_IMAGE_DATA_OFFSET && fwrite(data->raw_buffer, 1, length, file) == length;
+
+    fclose(file);
+
+    return written ? 0 : -1;
+}
+
+// Load a raw image from a buffer into an image data buffer, which is always in
+// the format the raw image is stored in
+int image_backend_raw(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt)
+{
+    struct pixel_buffer view;
+
+    if (raw_image_view(buffer, length, &view))
+    {
+        return -1;
+    }
+
+    // Rows which don't end on a byte can only be copied as they are
+    if (view.line_length != view.width * GET_BITS_PER_PIXEL(view.fmt) && (view.width * GET_BITS_PER_PIXEL(view.fmt)) % 8 != 0)
+    {
+        printf("Unsupported raw image\n");
+        return -1;
+    }
+
+    *data = alloc_pixel_buffer(view.fmt, view.width, view.height);
+
+    if (data->raw_buffer == NULL)
+    {
+        return -1;
+    }
+
+    // The rows of the image are packed together, where the rows of the file
+    // may not be
+    size_t row_length = (data->line_length + 7) / 8;
+
+    if (view.line_length == data->line_length)
+    {
+        memcpy(data->raw_buffer, view.raw_buffer, (data->line_length * data->height + 7) / 8);
+    }
+    else
+    {
+        for (size_t y = 0; y < data->height; y++)
+        {
+            memcpy(data->raw_buffer + y * data->line_length / 8, view.raw_buffer + y * view.line_length / 8, row_length);
+        }
+    }
+
+    return 0;
+}
+
+// Read the size and layout of a raw image from the start of a file, which must
+// hold at least the header. Returns 0 on success and -1 on failure.
+int image_probe_raw(void* buffer, size_t length, struct image_info* info)
+{
+    const struct raw_image_header* header = buffer;
+
+    if (length < sizeof(struct raw_image_header) || memcmp(header->magic, RAW_IMAGE_MAGIC, 4) != 0)
+    {
+        return -1;
+    }
+
+    size_t bits = GET_BITS_PER_PIXEL(header->fmt);
+    size_t channels = GET_NUM_CHANNELS(header->fmt);
+
+    if (header->fmt > 0xFF || bits == 0 || channels == 0)
+    {
+        printf("Invalid raw image\n");
+        return -1;
+    }
+
+    info->width = header->width;
+    info->height = header->height;
+    info->fmt = header->fmt;
+    info->bit_depth = bits / channels;
+    info->interlaced = false;
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef RAW_H
+#define RAW_H
+
+#include "libimg.h"
+
+#define RAW_IMAGE_MAGIC "QRAW"
+
+// Offset of the first row of pixels from the start of a raw image written by
+// raw_image_write, which keeps the rows aligned within a mapping
+#define RAW_IMAGE_DATA_OFFSET 32
+
+// Header at the start of a raw image, which is followed by the rows of pixels
+// exactly as a pixel_buffer holds them. Values are little endian.
+struct raw_image_header
+{
+    char magic[4];
+    uint32_t fmt;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; // Length of each row in bytes
+    uint32_t offset; // Offset of the first row from the start of the file
+};
+
+// Point a pixel buffer at the pixels of a raw image held in a buffer of the
+// given length, without copying them. Returns 0 on success and -1 on failure.
+int raw_image_view(void* buffer, size_t length, struct pixel_buffer* data);
+
+// Write a pixel buffer to a file as a raw image, returns 0 on success and -1
+// on failure
+int raw_image_write(const char* filename, const struct pixel_buffer* data);
+
+// Load a raw image from a buffer into an image data buffer, which is always in
+// the format the raw image is stored in
+int image_backend_raw(void* buffer, size_t length, struct pixel_buffer* data, pixel_format fmt);
+
+// Read the size and layout of a raw image from the start of a file, which must
+// hold at least the header. Returns 0 on success and -1 on failure.
+int image_probe_raw(void* buffer, size_t length, struct image_info* info);
+
+#endif // RAW_H
@@ -0,0 +1,240 @@
+#include "unfilter.h"
+
+/*
+    Each filter predicts a byte from the bytes of the pixel to its left (a),
+    the pixel above (b) and the pixel above and to the left (c), and stores
+    the difference. Up needs no left neighbour, so whole 64 bit words are
+    handled at once, adding each byte separately. Sub is a running sum along
+    the row, which is done a word at a time when pixels evenly divide a word:
+    the sum within the word takes a few shifted adds, then the last pixel of
+    the previous word is added to every pixel. Average depends on the byte to
+    its left after it has been unfiltered, so it is only done a pixel at a time
+    when a pixel fills a word or half of one. Paeth picks between neighbours
+    with masks instead of branches.
+
+    Every routine is written once and given the size of a pixel as a constant,
+    so each size gets its own copy with the size folded in.
+*/
+
+// Scanlines are written a byte at a time by the decompressor, so reading them
+// a word at a time must be allowed to alias those bytes
+typedef uint64_t __attribute__((may_alias)) word64;
+typedef uint32_t __attribute__((may_alias)) word32;
+
+#define LOW_BITS 0x7F7F7F7F7F7F7F7FULL
+#define HIGH_BITS 0x8080808080808080ULL
+
+// Add each byte of two words, with no carry from one byte into the next
+static inline uint64_t add_bytes(uint64_t x, uint64_t y)
+{
+    return ((x & LOW_BITS) + (y & LOW_BITS)) ^ ((x ^ y) & HIGH_BITS);
+}
+
+// Average (rounding down) each byte of two words
+static inline uint64_t average_bytes(uint64_t x, uint64_t y)
+{
+    return (x & y) + (((x ^ y) >> 1) & LOW_BITS);
+}
+
+// Absolute value without a branch
+static inline int absolute(int x)
+{
+    int sign = x >> (sizeof(int) * 8 - 1);
+
+    return (x ^ sign) - sign;
+}
+
+// The Paeth predictor, picking whichever of a, b and c is closest to
+// a + b - c, preferring a then b on ties
+static inline uint8_t paeth_predict(int a, int b, int c)
+{
+    int pa = b - c;
+    int pb = a - c;
+    int pc = absolute(pa + pb);
+
+    pa = absolute(pa);
+    pb = absolute(pb);
+
+    int use_a = -((pa <= pb) & (pa <= pc));
+    int use_b = ~use_a & -(pb <= pc);
+    int use_c = ~(use_a | use_b);
+
+    return (a & use_a) | (b & use_b) | (c & use_c);
+}
+
+static void unfilter_up(uint8_t* row, const uint8_t* prev, size_t length)
+{
+    word64* words = (word64*)row;
+    const word64* prev_words = (const word64*)prev;
+    size_t count = length / 8;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        words[i] = add_bytes(words[i], prev_words[i]);
+    }
+
+    for (size_t i = count * 8; i < length; i++)
+    {
+        row[i] += prev[i];
+    }
+}
+
+static inline void unfilter_sub(uint8_t* row, size_t length, size_t bpp)
+{
+    size_t start = bpp;
+
+    if (8 % bpp == 0)
+    {
+        word64* words = (word64*)row;
+        size_t count = length / 8;
+        uint64_t carry = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t word = words[i];
+
+            // Sum along the pixels of the word, then add on the sum so far
+            for (size_t shift = bpp; shift < 8; shift *= 2)
+            {
+                word = add_bytes(word, word << (8 * shift));
+            }
+
+            word = add_bytes(word, carry);
+            words[i] = word;
+
+            // The last pixel, repeated over the whole word
+            carry = word >> (64 - 8 * bpp);
+
+            for (size_t shift = bpp; shift < 8; shift *= 2)
+            {
+                carry |= carry << (8 * shift);
+            }
+        }
+
+        start = count * 8 > bpp ? count * 8 : bpp;
+    }
+
+    for (size_t i = start; i < length; i++)
+    {
+        row[i] += row[i - bpp];
+    }
+}
+
+static inline void unfilter_average(uint8_t* row, const uint8_t* prev, size_t length, size_t bpp)
+{
+    size_t start = 0;
+
+    if (bpp == 8 || bpp == 4)
+    {
+        size_t count = length / bpp;
+        uint64_t left = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t pixel;
+            uint64_t above;
+
+            if (bpp == 8)
+            {
+                pixel = ((word64*)row)[i];
+                above = ((const word64*)prev)[i];
+            }
+            else
+            {
+                pixel = ((word32*)row)[i];
+                above = ((const word32*)prev)[i];
+            }
+
+            left = add_bytes(pixel, average_bytes(left, above));
+
+            if (bpp == 8)
+            {
+                ((word64*)row)[i] = left;
+            }
+            else
+            {
+                ((word32*)row)[i] = left;
+            }
+        }
+
+        start = count * bpp;
+    }
+    else
+    {
+        for (size_t i = 0; i < bpp && i < length; i++)
+        {
+            row[i] += prev[i] / 2;
+        }
+
+        start = bpp;
+    }
+
+    for (size_t i = start; i < length; i++)
+    {
+        row[i] += (row[i - bpp] + prev[i]) / 2;
+    }
+}
+
+static inline void unfilter_paeth(uint8_t* row, const uint8_t* prev, size_t length, size_t bpp)
+{
+    // With nothing to the left, the pixel above is always the closest
+    for (size_t i = 0; i < bpp && i < length; i++)
+    {
+        row[i] += prev[i];
+    }
+
+    for (size_t i = bpp; i < length; i++)
+    {
+        row[i] += paeth_predict(row[i - bpp], prev[i], prev[i - bpp]);
+    }
+}
+
+#define UNFILTER_ROUTINES(bpp)                                                          \
+    static void unfilter_sub_##bpp(uint8_t* row, const uint8_t* prev, size_t length)    \
+    {                                                                                   \
+        (void)prev;                                                                     \
+        unfilter_sub(row, length, bpp);                                                 \
+    }                                                                                   \
+                                                                                        \
+    static void unfilter_average_##bpp(uint8_t* row, const uint8_t* prev, size_t length) \
+    {                                                                                   \
+        unfilter_average(row, prev, length, bpp);                                       \
+    }                                                                                   \
+                                                                                        \
+    static void unfilter_paeth_##bpp(uint8_t* row, const uint8_t* prev, size_t length)  \
+    {                                                                                   \
+        unfilter_paeth(row, prev, length, bpp);                                         \
+    }                                                                                   \
+                                                                                        \
+    static const unfilter_fn unfilters_##bpp[PNG_FILTERS] = {NULL, unfilter_sub_##bpp, unfilter_up, unfilter_average_##bpp, unfilter_paeth_##bpp};
+
+UNFILTER_ROUTINES(1)
+UNFILTER_ROUTINES(2)
+UNFILTER_ROUTINES(3)
+UNFILTER_ROUTINES(4)
+UNFILTER_ROUTINES(6)
+UNFILTER_ROUTINES(8)
+
+// Get the unfilter routines for pixels of the given size in bytes (1, 2, 3, 4,
+// 6 or 8, pixels smaller than a byte count as 1), indexed by filter type.
+// Returns a null pointer for any other size.
+const unfilter_fn* unfilter_routines(size_t bpp)
+{
+    switch (bpp)
+    {
+        case 1:
+            return unfilters_1;
+        case 2:
+            return unfilters_2;
+        case 3:
+            return unfilters_3;
+        case 4:
+            return unfilters_4;
+        case 6:
+            return unfilters_6;
+        case 8:
+            return unfilters_8;
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef UNFILTER_H
+#define UNFILTER_H
+
+#include <libc/stddef.h>
+#include <libc/stdint.h>
+
+// Number of filter types, 0 (none) needs no unfiltering
+#define PNG_FILTERS 5
+
+// Largest pixel size in bytes, 16 bit RGBA
+#define PNG_MAX_BPP 8
+
+// Undo a filter over a whole scanline in place, given the previous unfiltered
+// scanline. Both scanlines must start on an 8 byte boundary.
+typedef void (*unfilter_fn)(uint8_t* row, const uint8_t* prev, size_t length);
+
+// Get the unfilter routines for pixels of the given size in bytes (1, 2, 3, 4,
+// 6 or 8, pixels smaller than a byte count as 1), indexed by filter type.
+// Returns a null pointer for any other size.
+const unfilter_fn* unfilter_routines(size_t bpp);
+
+#endif // UNFILTER_H
@@ -0,0 +1,125 @@
+// Host-side benchmark reporting the speed and ratio of the compressor at each
+// level, every result is decompressed again to make sure it round trips
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libzip.h"
+
+// Read an entire file into memory
+static uint8_t* read_file(const char* filename, size_t* length)
+{
+    FILE* file = fopen(filename, "rb");
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(*length ? *length : 1);
+    *length = fread(data, 1, *length, file);
+    fclose(file);
+
+    return data;
+}
+
+// Current time in seconds
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s file [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t length;
+    uint8_t* data = read_file(argv[1], &length);
+
+    if (data == NULL)
+    {
+        printf("Unable to read `%s`\n", argv[1]);
+        return 2;
+    }
+
+    size_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+
+    printf("%s: %zu bytes, %zu iterations\n", argv[1], length, iterations);
+    printf("level  compressed    ratio  compress MB/s  decompress MB/s  allocs/decode\n");
+
+    for (int level = 0; level <= 9; level++)
+    {
+        size_t compressed_length = 0;
+        uint8_t* compressed = NULL;
+
+        double start = now();
+
+        for (size_t i = 0; i < iterations; i++)
+        {
+            free(compressed);
+            compressed = deflate_compress(data, length, level, &compressed_length);
+
+            if (compressed == NULL)
+            {
+                printf("Compression failed at level %d\n", level);
+                return 3;
+            }
+        }
+
+        double compress_time = now() - start;
+
+        size_t decompressed_length = 0;
+        uint8_t* decompressed = NULL;
+        size_t allocations = zip_allocation_count();
+
+        start = now();
+
+        for (size_t i = 0; i < iterations; i++)
+        {
+            free(decompressed);
+            decompressed = deflate_decompress_bounded(compressed, compressed_length, &decompressed_length);
+
+            if (decompressed == NULL)
+            {
+                printf("Decompression failed at level %d\n", level);
+                return 4;
+            }
+        }
+
+        double decompress_time = now() - start;
+
+        allocations = zip_allocation_count() - allocations;
+
+        if (decompressed_length != length || memcmp(decompressed, data, length) != 0)
+        {
+            printf("Round trip mismatch at level %d\n", level);
+            return 5;
+        }
+
+        double megabytes = (double)length * iterations / (1024.0 * 1024.0);
+
+        printf("%5d  %10zu  %6.2f%%  %13.1f  %15.1f  %13zu\n", level, compressed_length,
+            length ? 100.0 * compressed_length / length : 0.0,
+            megabytes / compress_time, megabytes / decompress_time, allocations / iterations);
+
+        free(compressed);
+        free(decompressed);
+    }
+
+    free(data);
+
+    return 0;
+}
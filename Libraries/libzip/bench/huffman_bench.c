@@ -0,0 +1,253 @@
+// Host-side benchmark comparing the table driven huffman decoder with the
+// original bit-by-bit tree walk on the same encoded symbol stream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "huffman.h"
+
+#define SYMBOLS 288
+#define MAX_BITS 15
+
+// Read an entire file into memory
+static uint8_t* read_file(const char* filename, size_t* length)
+{
+    FILE* file = fopen(filename, "rb");
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(*length);
+    *length = fread(data, 1, *length, file);
+    fclose(file);
+
+    return data;
+}
+
+// Current time in seconds
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Compute huffman code lengths for the given frequencies, limited to MAX_BITS
+static void build_lengths(const size_t* freq, uint8_t* lengths)
+{
+    size_t weight[2 * SYMBOLS];
+    int parent[2 * SYMBOLS];
+    size_t scaled[SYMBOLS];
+
+    memcpy(scaled, freq, sizeof(scaled));
+
+    for (;;)
+    {
+        size_t nodes = SYMBOLS;
+        uint8_t alive[2 * SYMBOLS] = {0};
+
+        for (size_t i = 0; i < SYMBOLS; i++)
+        {
+            weight[i] = scaled[i];
+            parent[i] = -1;
+            alive[i] = scaled[i] != 0;
+        }
+
+        // Repeatedly merge the two lightest live nodes
+        for (;;)
+        {
+            int a = -1, b = -1;
+
+            for (size_t i = 0; i < nodes; i++)
+            {
+                if (!alive[i]) continue;
+
+                if (a < 0 || weight[i] < weight[a]) { b = a; a = i; }
+                else if (b < 0 || weight[i] < weight[b]) { b = i; }
+            }
+
+            if (b < 0) break;
+
+            weight[nodes] = weight[a] + weight[b];
+            parent[nodes] = -1;
+            alive[nodes] = 1;
+            alive[a] = alive[b] = 0;
+            parent[a] = parent[b] = nodes;
+            nodes++;
+        }
+
+        uint8_t max = 0;
+
+        for (size_t i = 0; i < SYMBOLS; i++)
+        {
+            uint8_t depth = 0;
+
+            for (int p = parent[i]; p >= 0 && scaled[i]; p = parent[p])
+            {
+                depth++;
+            }
+
+            lengths[i] = depth;
+            max = depth > max ? depth : max;
+        }
+
+        if (max <= MAX_BITS)
+        {
+            return;
+        }
+
+        // Flatten the distribution and try again
+        for (size_t i = 0; i < SYMBOLS; i++)
+        {
+            scaled[i] = scaled[i] ? (scaled[i] + 1) / 2 : 0;
+        }
+    }
+}
+
+// Encode the data with the canonical code described by lengths, the stream is
+// padded so decoders may look ahead past the final symbol
+static uint8_t* encode(const uint8_t* data, size_t length, const uint8_t* lengths, size_t* out_length)
+{
+    uint16_t bl_count[MAX_BITS + 1] = {0};
+    uint16_t next_code[MAX_BITS + 1] = {0};
+    uint16_t codes[SYMBOLS];
+
+    for (size_t i = 0; i < SYMBOLS; i++) bl_count[lengths[i]]++;
+    bl_count[0] = 0;
+
+    for (size_t bits = 2; bits <= MAX_BITS; bits++)
+    {
+        next_code[bits] = (next_code[bits - 1] + bl_count[bits - 1]) << 1;
+    }
+
+    for (size_t i = 0; i < SYMBOLS; i++)
+    {
+        if (lengths[i]) codes[i] = next_code[lengths[i]]++;
+    }
+
+    uint8_t* out = calloc(length * 2 + 16, 1);
+    size_t bit = 0;
+
+    for (size_t i = 0; i <= length; i++)
+    {
+        uint16_t sym = i == length ? 256 : data[i];
+
+        // Huffman codes are written starting from their most significant bit
+        for (int b = lengths[sym] - 1; b >= 0; b--)
+        {
+            out[bit >> 3] |= ((codes[sym] >> b) & 1) << (bit & 7);
+            bit++;
+        }
+    }
+
+    *out_length = (bit + 7) / 8;
+    return out;
+}
+
+static void run(const char* name, const uint8_t* data, size_t length, const uint8_t* lengths, int rounds)
+{
+    size_t encoded_length;
+    uint8_t* encoded = encode(data, length, lengths, &encoded_length);
+    uint8_t* decoded = malloc(length + 1);
+
+    uint16_t alphabet[SYMBOLS];
+    for (size_t i = 0; i < SYMBOLS; i++) alphabet[i] = i;
+
+    struct huffman_node* tree = huffman_from_bit_lengths((uint8_t*)lengths, alphabet, SYMBOLS);
+
+    struct huffman_entry* entries = malloc(HUFFMAN_LIT_LEN_ENTRIES * sizeof(struct huffman_entry));
+    struct huffman_table table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_LIT_LEN_ENTRIES};
+    if (huffman_table_from_bit_lengths(&table, entries, lengths, SYMBOLS, HUFFMAN_LIT_LEN_ROOT))
+    {
+        printf("%s: unable to build table\n", name);
+        exit(1);
+    }
+
+    double times[2];
+
+    for (int method = 0; method < 2; method++)
+    {
+        double start = now();
+
+        for (int r = 0; r < rounds; r++)
+        {
+            struct bitstream stream;
+            bitstream_init(&stream, encoded, encoded_length);
+            size_t count = 0;
+            uint16_t sym;
+
+            for (;;)
+            {
+                uint8_t bad = method == 0 ? huffman_decode(tree, &stream, &sym) : huffman_decode_table(&table, &stream, &sym);
+
+                if (bad || sym == 256) break;
+                decoded[count++] = sym;
+            }
+
+            if (count != length || memcmp(decoded, data, length) != 0)
+            {
+                printf("%s: %s decode mismatch\n", name, method == 0 ? "tree" : "table");
+                exit(1);
+            }
+        }
+
+        times[method] = now() - start;
+    }
+
+    double mb = (double)length * rounds / (1024.0 * 1024.0);
+
+    printf("%-8s %8.2f MB/s tree  %8.2f MB/s table  %5.2fx\n", name, mb / times[0], mb / times[1], times[0] / times[1]);
+
+    huffman_free(tree);
+    free(entries);
+    free(encoded);
+    free(decoded);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s FILE [ROUNDS]\n", argv[0]);
+        return 1;
+    }
+
+    size_t length;
+    uint8_t* data = read_file(argv[1], &length);
+
+    if (data == NULL)
+    {
+        printf("Unable to read `%s`\n", argv[1]);
+        return 1;
+    }
+
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+    // The fixed literal code from the DEFLATE specification
+    uint8_t fixed[SYMBOLS];
+    for (size_t i = 0; i < SYMBOLS; i++) fixed[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+
+    // A code fitted to the input, as a dynamic block would use
+    size_t freq[SYMBOLS] = {0};
+    for (size_t i = 0; i < length; i++) freq[data[i]]++;
+    freq[256] = 1;
+
+    uint8_t dynamic[SYMBOLS];
+    build_lengths(freq, dynamic);
+
+    run("fixed", data, length, fixed, rounds);
+    run("dynamic", data, length, dynamic, rounds);
+
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,348 @@
+// Host-side benchmark of the decompressor on a fixed corpus, so results can be
+// compared between commits. Every input is either a single member gzip file or
+// a PNG, whose IDAT chunks are joined into one zlib stream. Each input is run
+// in its own process, so the peak memory reported belongs to that input alone.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "libzip.h"
+
+// The decoded data is compressed again, as it is the only copy available
+#define COMPRESS_LEVEL DEFLATE_LEVEL_DEFAULT
+
+struct stream
+{
+    // Raw DEFLATE data
+    uint8_t* data;
+    size_t length;
+
+    // Decompressed length if it is known, and the crc32 or adler32 of the
+    // decompressed data
+    size_t expected;
+    uint32_t check;
+    int check_type;
+};
+
+struct result
+{
+    int status;
+
+    size_t length;
+    double inflate_time;
+    double deflate_time;
+    size_t compressed_length;
+    size_t allocations;
+    long peak_kib;
+};
+
+// Read an entire file into memory
+static uint8_t* read_file(const char* filename, size_t* length)
+{
+    FILE* file = fopen(filename, "rb");
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(*length ? *length : 1);
+    *length = fread(data, 1, *length, file);
+    fclose(file);
+
+    return data;
+}
+
+// Current time in seconds
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Peak resident memory of this process in KiB
+static long peak_memory()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+static uint32_t read_u32_le(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint32_t read_u32_be(const uint8_t* bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+// Find the DEFLATE stream inside a gzip file, returns 0 on success
+static int open_gzip(const uint8_t* data, size_t length, struct stream* stream)
+{
+    size_t header = gzip_header_length(data, length);
+
+    if (header == 0 || length - header < 8)
+    {
+        return -1;
+    }
+
+    stream->length = length - header - 8;
+    stream->data = malloc(stream->length + 1);
+    memcpy(stream->data, data + header, stream->length);
+
+    stream->expected = read_u32_le(data + length - 4);
+    stream->check = read_u32_le(data + length - 8);
+    stream->check_type = INFLATE_CHECK_CRC32;
+
+    return 0;
+}
+
+// Join the IDAT chunks of a PNG and find the DEFLATE stream inside, returns 0
+// on success
+static int open_png(const uint8_t* data, size_t length, struct stream* stream)
+{
+    uint8_t* joined = malloc(length);
+    size_t joined_length = 0;
+
+    for (size_t offset = 8; offset + 12 <= length;)
+    {
+        size_t chunk_length = read_u32_be(data + offset);
+
+        if (chunk_length > length - offset - 12)
+        {
+            break;
+        }
+
+        if (memcmp(data + offset + 4, "IDAT", 4) == 0)
+        {
+            memcpy(joined + joined_length, data + offset + 8, chunk_length);
+            joined_length += chunk_length;
+        }
+
+        offset += chunk_length + 12;
+    }
+
+    // Skip the zlib header, streams with a preset dictionary are not expected
+    if (joined_length < 6 || (joined[1] & 0x20))
+    {
+        free(joined);
+        return -1;
+    }
+
+    stream->length = joined_length - 6;
+    stream->data = malloc(stream->length + 1);
+    memcpy(stream->data, joined + 2, stream->length);
+
+    stream->expected = 0;
+    stream->check = read_u32_be(joined + joined_length - 4);
+    stream->check_type = INFLATE_CHECK_ADLER32;
+
+    free(joined);
+
+    return 0;
+}
+
+// Decompress and compress a stream, returns the results with a nonzero status
+// if anything failed
+static struct result run(const struct stream* stream, size_t iterations)
+{
+    struct result result = {0};
+    long start_memory = peak_memory();
+
+    // The fastest run is kept, as it is the least disturbed by anything else
+    // running at the same time
+    result.inflate_time = -1;
+
+    uint8_t* decompressed = NULL;
+    size_t allocations = zip_allocation_count();
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        free(decompressed);
+
+        double start = now();
+        decompressed = deflate_decompress_bounded(stream->data, stream->length, &result.length);
+        double time = now() - start;
+
+        if (decompressed == NULL)
+        {
+            result.status = 1;
+            return result;
+        }
+
+        if (result.inflate_time < 0 || time < result.inflate_time)
+        {
+            result.inflate_time = time;
+        }
+    }
+
+    result.allocations = (zip_allocation_count() - allocations) / iterations;
+    result.peak_kib = peak_memory() - start_memory;
+
+    uint32_t check = stream->check_type == INFLATE_CHECK_CRC32 ? crc32_update(0, decompressed, result.length) : adler32_update(1, decompressed, result.length);
+
+    if (check != stream->check || (stream->expected && (uint32_t)result.length != stream->expected))
+    {
+        result.status = 2;
+        return result;
+    }
+
+    result.deflate_time = -1;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        double start = now();
+        uint8_t* compressed = deflate_compress(decompressed, result.length, COMPRESS_LEVEL, &result.compressed_length);
+        double time = now() - start;
+
+        if (compressed == NULL)
+        {
+            result.status = 3;
+            return result;
+        }
+
+        free(compressed);
+
+        if (result.deflate_time < 0 || time < result.deflate_time)
+        {
+            result.deflate_time = time;
+        }
+    }
+
+    free(decompressed);
+
+    return result;
+}
+
+// Run the benchmark in a child process, so its peak memory is not mixed up
+// with any other input's
+static struct result run_isolated(const struct stream* stream, size_t iterations)
+{
+    struct result result = {.status = -1};
+    int fds[2];
+
+    if (pipe(fds))
+    {
+        return result;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+
+        result = run(stream, iterations);
+        write(fds[1], &result, sizeof(result));
+
+        _exit(0);
+    }
+
+    close(fds[1]);
+
+    if (pid < 0 || read(fds[0], &result, sizeof(result)) != sizeof(result))
+    {
+        result.status = -1;
+    }
+
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s iterations file...\n", argv[0]);
+        return 1;
+    }
+
+    size_t iterations = strtoul(argv[1], NULL, 10);
+
+    if (iterations == 0)
+    {
+        iterations = 1;
+    }
+
+    printf("%zu iterations, best run reported, compressing at level %d\n", iterations, COMPRESS_LEVEL);
+    printf("%-20s  %10s  %10s  %12s  %12s  %14s  %8s\n", "input", "bytes", "deflated", "inflate MB/s", "deflate MB/s", "allocs/inflate", "peak KiB");
+
+    size_t total_length = 0;
+    double total_time = 0;
+    int failed = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+        const char* name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+
+        size_t length;
+        uint8_t* data = read_file(argv[i], &length);
+
+        if (data == NULL)
+        {
+            printf("Unable to read `%s`\n", argv[i]);
+            return 2;
+        }
+
+        struct stream stream;
+        int status = -1;
+
+        if (length >= 2 && data[0] == GZIP_MAGIC0 && data[1] == GZIP_MAGIC1)
+        {
+            status = open_gzip(data, length, &stream);
+        }
+        else if (length >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0)
+        {
+            status = open_png(data, length, &stream);
+        }
+
+        free(data);
+
+        if (status)
+        {
+            printf("`%s` is not a gzip file or a PNG\n", argv[i]);
+            return 3;
+        }
+
+        struct result result = run_isolated(&stream, iterations);
+        free(stream.data);
+
+        if (result.status)
+        {
+            printf("%-20s  failed (%d)\n", name, result.status);
+            failed = 1;
+            continue;
+        }
+
+        double megabytes = (double)result.length / (1024.0 * 1024.0);
+
+        printf("%-20s  %10zu  %10zu  %12.1f  %12.1f  %14zu  %8ld\n", name, result.length, result.compressed_length,
+            megabytes / result.inflate_time, megabytes / result.deflate_time, result.allocations, result.peak_kib);
+
+        total_length += result.length;
+        total_time += result.inflate_time;
+    }
+
+    if (total_time > 0)
+    {
+        printf("%-20s  %10zu  %10s  %12.1f\n", "total", total_length, "", (double)total_length / (1024.0 * 1024.0) / total_time);
+    }
+
+    return failed ? 4 : 0;
+}
@@ -2,20 +2,21 @@
 
 #include <libc/assert.h>
 
+// Start reading length bytes of data as a bitstream
+void bitstream_init(struct bitstream* s, const void* data, size_t length)
+{
+    s->ptr = data;
+    s->length = length;
+    s->byte = 0;
+    s->buffer = 0;
+    s->count = 0;
+    s->overrun = 0;
+}
+
 // Read a single bit from the bitstream
 uint8_t read_bit(struct bitstream* s)
 {
-    uint8_t bit = ((*((uint8_t*)s->ptr + s->byte)) >> s->bit) & 1;
-
-    s->bit += 1;
-
-    if (s->bit == 8) 
-    {
-        s->byte++;
-        s->bit = 0;
-    }
-
-    return bit;
+    return (uint8_t)read_bits32(s, 1);
 }
 
 // Read multiple bits from the bitstream, placing the most recent read into the most significant bit (maximum of 8 bits can be read with this function)
@@ -23,14 +24,7 @@ uint8_t read_bits(struct bitstream* s, size_t count)
 {
     assert(count <= 8);
 
-    uint8_t result = 0;
-
-    for (size_t i = 0; i < count; i++)
-    {
-        result |= read_bit(s) << i;
-    }
-
-    return result;
+    return (uint8_t)read_bits32(s, count);
 }
 
 // Read multiple bits from the bitstream, placing the most recent read into the most significant bit (maximum of 16 bits can be read with this function)
@@ -38,36 +32,62 @@ uint16_t read_bits16(struct bitstream* s, size_t count)
 {
     assert(count <= 16);
 
-    uint16_t result = 0;
-
-    for (size_t i = 0; i < count; i++)
-    {
-        result |= (uint16_t)read_bit(s) << i;
-    }
-
-    return result;
+    return (uint16_t)read_bits32(s, count);
 }
 
 // Flush the bit stream such that it is pointing to a byte boundary
 void flush_to_next_byte(struct bitstream* s)
 {
-    if (s->bit != 0)
-    {
-        s->bit = 0;
-        s->byte++;
-    }
+    consume_bits(s, s->count & 7);
 }
 
 // Read a byte from the bitstream
 uint8_t read_byte(struct bitstream* s)
 {
-    return ((uint8_t*)s->ptr)[s->byte++];
+    return (uint8_t)read_bits32(s, 8);
 }
 
-// Read a short from the bitstream
+// Read a little endian short from the bitstream
 uint16_t read_short(struct bitstream* s)
 {
-    size_t offset = s->byte;
-    s->byte += 2;
-    return ((uint8_t*)s->ptr)[offset];
-}
\ No newline at end of file
+    return (uint16_t)read_bits32(s, 16);
+}
+
+// Copy bytes out of a bitstream which is sitting on a byte boundary, returns
+// the number of bytes copied, which is less than count if the input runs out
+size_t read_bytes(struct bitstream* s, uint8_t* dest, size_t count)
+{
+    assert((s->count & 7) == 0);
+
+    size_t copied = 0;
+
+    // First drain whatever is still held in the accumulator
+    while (copied < count && s->count >= 8)
+    {
+        dest[copied++] = (uint8_t)s->buffer;
+        s->buffer >>= 8;
+        s->count -= 8;
+    }
+
+    if (copied < count)
+    {
+        // The accumulator is now empty, but bytes after the ones consumed may
+        // have been left in it by a word refill
+        s->buffer = 0;
+
+        // Copy the rest straight from the input
+        size_t available = s->length - s->byte;
+        size_t bulk = count - copied < available ? count - copied : available;
+
+        memcpy(dest + copied, s->ptr + s->byte, bulk);
+        s->byte += bulk;
+        copied += bulk;
+    }
+
+    if (copied < count)
+    {
+        s->overrun = 1;
+    }
+
+    return copied;
+}
@@ -3,20 +3,96 @@
 
 #include <libc/stdint.h>
 #include <libc/stddef.h>
+#include <libc/string.h>
 
+// Bits are loaded from the input a word at a time into a 64 bit accumulator,
+// the next bit of the stream is always the least significant bit of buffer
 struct bitstream
 {
-    void* ptr;
+    const uint8_t* ptr;
+    size_t length;
     size_t byte;
-    size_t bit;
+
+    uint64_t buffer;
+    size_t count;
+
+    uint8_t overrun;
 };
 
+void bitstream_init(struct bitstream* s, const void* data, size_t length);
+
 uint8_t read_bit(struct bitstream* s);
 uint8_t read_bits(struct bitstream* s, size_t count);
 uint16_t read_bits16(struct bitstream* s, size_t count);
 void flush_to_next_byte(struct bitstream* s);
 uint8_t read_byte(struct bitstream* s);
 uint16_t read_short(struct bitstream* s);
+size_t read_bytes(struct bitstream* s, uint8_t* dest, size_t count);
+
+// Top the accumulator up, after this call at least 56 bits are available
+// unless the end of the input has been reached
+static inline void bitstream_refill(struct bitstream* s)
+{
+    if (s->length - s->byte >= 8)
+    {
+        // Load a whole (little endian) word, only the bytes which fit are
+        // counted as consumed, the rest will be loaded again next time in the
+        // same position, so leaving them in the accumulator is harmless
+        uint64_t word;
+        memcpy(&word, s->ptr + s->byte, 8);
+
+        s->buffer |= word << s->count;
+        s->byte += (63 - s->count) >> 3;
+        s->count |= 56;
+    }
+    else
+    {
+        // Near the end of the input, load whatever bytes remain one at a time
+        while (s->count <= 56 && s->byte < s->length)
+        {
+            s->buffer |= (uint64_t)s->ptr[s->byte++] << s->count;
+            s->count += 8;
+        }
+    }
+}
+
+// Look at the next bits in the bitstream without consuming them, the first
+// bit is placed in the least significant bit (maximum of 32 bits can be read
+// with this function), bits past the end of the input read as zero
+static inline uint32_t peek_bits(struct bitstream* s, size_t count)
+{
+    if (s->count < count)
+    {
+        bitstream_refill(s);
+    }
+
+    return (uint32_t)(s->buffer & (((uint64_t)1 << count) - 1));
+}
+
+// Skip past bits which have already been inspected with peek_bits
+static inline void consume_bits(struct bitstream* s, size_t count)
+{
+    if (count > s->count)
+    {
+        // Consumed bits which were never in the input
+        s->overrun = 1;
+        s->buffer = 0;
+        s->count = 0;
+        return;
+    }
+
+    s->buffer >>= count;
+    s->count -= count;
+}
+
+// Read multiple bits from the bitstream, placing the first bit read into the
+// least significant bit (maximum of 32 bits can be read with this function)
+static inline uint32_t read_bits32(struct bitstream* s, size_t count)
+{
+    uint32_t result = peek_bits(s, count);
+    consume_bits(s, count);
 
+    return result;
+}
 
-#endif // BITSTREAM
\ No newline at end of file
+#endif // BITSTREAM
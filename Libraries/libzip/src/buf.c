@@ -2,12 +2,48 @@
 
 #include <libc/string.h>
 
-// Expand an expandable buffer
-void expand_buffer(struct exp_buffer* b)
+#include "libzip.h"
+
+// Number of allocations made so far, this is not synchronised, so it is only
+// exact when a single thread is using the library
+static size_t allocation_count = 0;
+
+// Allocate memory for the library, every allocation made is counted
+void* zip_malloc(size_t size)
+{
+    allocation_count++;
+    return malloc(size);
+}
+
+void* zip_realloc(void* ptr, size_t size)
+{
+    allocation_count++;
+    return realloc(ptr, size);
+}
+
+// Number of heap allocations the library has made, which can be compared
+// before and after a call to find how many it made
+size_t zip_allocation_count()
+{
+    return allocation_count;
+}
+
+// Expand an expandable buffer, returns -1 if it cannot grow
+int expand_buffer(struct exp_buffer* b)
 {
+    if (b->fixed)
+    {
+        return -1;
+    }
+
     // Allocate a new buffer with twice the size
-    size_t new_size = b->size * 2;
-    uint8_t* new_buf = malloc(new_size);
+    size_t new_size = b->size ? b->size * 2 : 16;
+    uint8_t* new_buf = zip_malloc(new_size);
+
+    if (new_buf == NULL)
+    {
+        return -1;
+    }
 
     // Move the old data over
     memcpy(new_buf, b->buf, b->index);
@@ -18,25 +54,50 @@ void expand_buffer(struct exp_buffer* b)
     // Update the buffer pointer and size variables
     b->buf = new_buf;
     b->size = new_size;
+
+    return 0;
 }
 
-// Add a byte to the expandable buffer
-void append_byte_to_buffer(struct exp_buffer* buf, uint8_t byte)
+// Add a byte to the expandable buffer, returns -1 if there is no room for it
+int append_byte_to_buffer(struct exp_buffer* buf, uint8_t byte)
 {
     // Make sure there is enough space in the buffer
-    while (buf->size <= buf->index)
+    if (buf->size <= buf->index && reserve_buffer(buf, 1))
     {
-        expand_buffer(buf);
+        return -1;
     }
 
     // Insert the new byte
     buf->buf[buf->index++] = byte;
+
+    return 0;
+}
+
+// Make sure there is room for count more bytes in the expandable buffer,
+// returns -1 if there is not
+int reserve_buffer(struct exp_buffer* buf, size_t count)
+{
+    while (buf->size - buf->index < count)
+    {
+        if (expand_buffer(buf))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
 // Create a new expandable buffer
 struct exp_buffer new_exp_buffer(size_t size)
 {
-    struct exp_buffer buf = (struct exp_buffer){.buf = malloc(size), .size = size, .index = 0};
+    struct exp_buffer buf = (struct exp_buffer){.buf = zip_malloc(size), .size = size, .index = 0, .fixed = 0};
 
     return buf;
 }
+
+// Wrap memory owned by the caller as a buffer, which never grows past size
+struct exp_buffer fixed_exp_buffer(void* buf, size_t size)
+{
+    return (struct exp_buffer){.buf = buf, .size = size, .index = 0, .fixed = 1};
+}
@@ -9,10 +9,17 @@ struct exp_buffer
     uint8_t* buf;
     size_t size;
     size_t index;
+    uint8_t fixed; // Set if the memory belongs to the caller and cannot grow
 };
 
-void expand_buffer(struct exp_buffer* b);
-void append_byte_to_buffer(struct exp_buffer* buf, uint8_t byte);
+// Allocate memory for the library, every allocation made is counted
+void* zip_malloc(size_t size);
+void* zip_realloc(void* ptr, size_t size);
+
+int expand_buffer(struct exp_buffer* b);
+int append_byte_to_buffer(struct exp_buffer* buf, uint8_t byte);
+int reserve_buffer(struct exp_buffer* buf, size_t count);
 struct exp_buffer new_exp_buffer(size_t size);
+struct exp_buffer fixed_exp_buffer(void* buf, size_t size);
 
-#endif // BUF_H
\ No newline at end of file
+#endif // BUF_H
@@ -0,0 +1,95 @@
+#include "libzip.h"
+
+#include <libc/string.h>
+
+/*
+    The CRC-32 is computed eight bytes at a time with the slicing-by-8 method:
+    crc_tables[k][n] is the crc of the byte n followed by k zero bytes, so the
+    contributions of eight input bytes can be looked up independently and
+    combined with xor instead of being processed one after another.
+*/
+
+// Largest number of bytes which can be summed before the Adler-32 sums have
+// to be reduced, keeping them within 32 bits
+#define ADLER_NMAX 5552
+#define ADLER_BASE 65521
+
+// The crc tables, for the reflected polynomial 0xEDB88320, are generated when
+// the library is built
+#include "crc_tables.h"
+
+// Update a running CRC-32 (as used by gzip and PNG) with more data, the crc
+// of no data is zero
+uint32_t crc32_update(uint32_t crc, const void* data, size_t length)
+{
+    const uint8_t* bytes = data;
+
+    crc = ~crc;
+
+    while (length >= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+
+        // The input words are little endian, as is the target
+        memcpy(&low, bytes, 4);
+        memcpy(&high, bytes + 4, 4);
+        low ^= crc;
+
+        crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF] ^
+              crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24] ^
+              crc_tables[3][high & 0xFF] ^ crc_tables[2][(high >> 8) & 0xFF] ^
+              crc_tables[1][(high >> 16) & 0xFF] ^ crc_tables[0][high >> 24];
+
+        bytes += 8;
+        length -= 8;
+    }
+
+    while (length--)
+    {
+        crc = crc_tables[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+// Update a running Adler-32 (as used by the zlib format) with more data, the
+// checksum of no data is one
+uint32_t adler32_update(uint32_t adler, const void* data, size_t length)
+{
+    const uint8_t* bytes = data;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (length > 0)
+    {
+        size_t count = length < ADLER_NMAX ? length : ADLER_NMAX;
+        length -= count;
+
+        while (count >= 8)
+        {
+            a += bytes[0]; b += a;
+            a += bytes[1]; b += a;
+            a += bytes[2]; b += a;
+            a += bytes[3]; b += a;
+            a += bytes[4]; b += a;
+            a += bytes[5]; b += a;
+            a += bytes[6]; b += a;
+            a += bytes[7]; b += a;
+
+            bytes += 8;
+            count -= 8;
+        }
+
+        while (count--)
+        {
+            a += *bytes++;
+            b += a;
+        }
+
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return (b << 16) | a;
+}
@@ -0,0 +1,1033 @@
+#include "libzip.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "buf.h"
+#include "deflate.h"
+
+/*
+    The match finder follows the structure of zlib's deflate: a hash of the
+    next three bytes selects a chain of earlier positions, which are searched
+    for the longest match, optionally deferring each match by one byte to see
+    if a longer one starts there (lazy matching).
+*/
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define HASH_MASK (HASH_SIZE - 1)
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+// Enough lookahead to always be able to find a maximum length match
+#define MIN_LOOKAHEAD (MAX_MATCH + MIN_MATCH + 1)
+#define MAX_DIST (WINDOW_SIZE - MIN_LOOKAHEAD)
+
+// Matches of length 3 further back than this cost more than the literals
+#define TOO_FAR 4096
+
+// Number of symbols gathered before a block is emitted
+#define SYMBOL_BUFFER_SIZE 16384
+
+#define LIT_LEN_CODES 286
+#define DIST_CODES 30
+#define CODE_LEN_CODES 19
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Search parameters for a compression level
+struct level_config
+{
+    uint16_t good_length; // Search less once a match this long has been found
+    uint16_t max_lazy; // Do not look for a lazy match past this length (greedy levels: do not hash past this length)
+    uint16_t nice_length; // Stop searching once a match this long has been found
+    uint16_t max_chain; // Maximum number of chain entries to search
+    uint8_t lazy; // Whether matches are deferred
+};
+
+static const struct level_config Levels[10] = {
+    {0, 0, 0, 0, 0}, // Stored blocks only
+    {4, 4, 8, 4, 0},
+    {4, 5, 16, 8, 0},
+    {4, 6, 32, 32, 0},
+    {4, 4, 16, 16, 1},
+    {8, 16, 32, 32, 1},
+    {8, 16, 128, 128, 1},
+    {8, 32, 128, 256, 1},
+    {32, 128, 258, 1024, 1},
+    {32, 258, 258, 4096, 1}
+};
+
+// A single literal (distance of zero) or match gathered for the current block
+struct deflate_symbol
+{
+    uint8_t value; // Literal byte, or the match length minus three
+    uint16_t distance;
+};
+
+struct deflate_state
+{
+    int level;
+    struct level_config config;
+
+    // Two windows worth of input, the upper half slides down once full
+    uint8_t window[2 * WINDOW_SIZE];
+    size_t strstart;
+    size_t lookahead;
+    long block_start;
+
+    // Hash chains, positions are offsets into the window with zero as the end
+    uint16_t head[HASH_SIZE];
+    uint16_t prev[WINDOW_SIZE];
+
+    // Lazy matching state
+    size_t match_length;
+    size_t match_start;
+    size_t prev_length;
+    size_t prev_match;
+    uint8_t match_available;
+
+    // Symbols and frequencies for the current block
+    struct deflate_symbol symbols[SYMBOL_BUFFER_SIZE];
+    size_t symbol_count;
+    size_t lit_len_freq[LIT_LEN_CODES];
+    size_t dist_freq[DIST_CODES];
+
+    // Symbol lookup for match lengths (minus three) and distances
+    uint8_t length_code[256];
+    uint8_t dist_code[512];
+
+    // Compressed output produced by the current call
+    struct exp_buffer out;
+    uint64_t bit_buffer;
+    size_t bit_count;
+
+    uint8_t finished;
+};
+
+// Codes for a block, stored bit reversed so they can be written directly
+struct block_codes
+{
+    uint8_t lit_len_lengths[288];
+    uint16_t lit_len_codes[288];
+    uint8_t dist_lengths[32];
+    uint16_t dist_codes[32];
+};
+
+// Distance symbol for a match distance
+static inline uint8_t distance_symbol(struct deflate_state* s, size_t distance)
+{
+    return distance <= 256 ? s->dist_code[distance - 1] : s->dist_code[256 + ((distance - 1) >> 7)];
+}
+
+// Write bits to the output, the first bit written is the least significant
+static inline void put_bits(struct deflate_state* s, uint32_t value, size_t count)
+{
+    s->bit_buffer |= (uint64_t)value << s->bit_count;
+    s->bit_count += count;
+
+    if (s->bit_count >= 32)
+    {
+        reserve_buffer(&s->out, 4);
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            s->out.buf[s->out.index++] = (uint8_t)(s->bit_buffer >> (8 * i));
+        }
+
+        s->bit_buffer >>= 32;
+        s->bit_count -= 32;
+    }
+}
+
+// Pad the output to the next byte boundary and write out every whole byte
+static void flush_bits(struct deflate_state* s)
+{
+    reserve_buffer(&s->out, 8);
+
+    while (s->bit_count > 0)
+    {
+        s->out.buf[s->out.index++] = (uint8_t)s->bit_buffer;
+        s->bit_buffer >>= 8;
+        s->bit_count = s->bit_count > 8 ? s->bit_count - 8 : 0;
+    }
+
+    s->bit_buffer = 0;
+}
+
+// Reverse the lowest bits bits of a code
+static uint16_t reverse_bits(uint16_t code, uint8_t bits)
+{
+    uint16_t result = 0;
+
+    for (uint8_t i = 0; i < bits; i++)
+    {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+
+    return result;
+}
+
+// Assign canonical codes to a set of lengths
+static void build_codes(const uint8_t* lengths, uint16_t* codes, size_t n)
+{
+    uint16_t bl_count[16] = {0};
+    uint16_t next_code[16] = {0};
+
+    for (size_t i = 0; i < n; i++)
+    {
+        bl_count[lengths[i]]++;
+    }
+
+    bl_count[0] = 0;
+
+    for (size_t bits = 1; bits < 16; bits++)
+    {
+        next_code[bits] = (next_code[bits - 1] + bl_count[bits - 1]) << 1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        codes[i] = lengths[i] ? reverse_bits(next_code[lengths[i]]++, lengths[i]) : 0;
+    }
+}
+
+// Compute huffman code lengths no longer than max_bits for the frequencies
+static void build_lengths(const size_t* freq, size_t n, uint8_t max_bits, uint8_t* lengths)
+{
+    uint16_t order[LIT_LEN_CODES];
+    size_t weight[LIT_LEN_CODES];
+    size_t count = 0;
+
+    memset(lengths, 0, n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (freq[i])
+        {
+            order[count++] = i;
+        }
+    }
+
+    // A code needs at least two symbols to be decodable everywhere
+    for (size_t i = 0; count < 2 && i < n; i++)
+    {
+        if (!freq[i] && (count == 0 || order[0] != i))
+        {
+            order[count++] = i;
+        }
+    }
+
+    // Sort the used symbols by increasing frequency
+    for (size_t i = 1; i < count; i++)
+    {
+        uint16_t sym = order[i];
+        size_t j = i;
+
+        while (j > 0 && freq[order[j - 1]] > freq[sym])
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+
+        order[j] = sym;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        weight[i] = freq[order[i]] ? freq[order[i]] : 1;
+    }
+
+    // Moffat and Katajainen's in-place minimum redundancy code computation,
+    // which turns the sorted weights into code lengths
+    size_t root = 0;
+    size_t leaf = 2;
+    weight[0] += weight[1];
+
+    for (size_t next = 1; next < count - 1; next++)
+    {
+        if (leaf >= count || weight[root] < weight[leaf])
+        {
+            weight[next] = weight[root];
+            weight[root++] = next;
+        }
+        else
+        {
+            weight[next] = weight[leaf++];
+        }
+
+        if (leaf >= count || (root < next && weight[root] < weight[leaf]))
+        {
+            weight[next] += weight[root];
+            weight[root++] = next;
+        }
+        else
+        {
+            weight[next] += weight[leaf++];
+        }
+    }
+
+    weight[count - 2] = 0;
+
+    for (long next = (long)count - 3; next >= 0; next--)
+    {
+        weight[next] = weight[weight[next]] + 1;
+    }
+
+    long avail = 1;
+    long used = 0;
+    size_t depth = 0;
+    long internal = (long)count - 2;
+    long next = (long)count - 1;
+
+    while (avail > 0)
+    {
+        while (internal >= 0 && weight[internal] == depth)
+        {
+            used++;
+            internal--;
+        }
+
+        while (avail > used)
+        {
+            weight[next--] = depth;
+            avail--;
+        }
+
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+
+    // Limit the lengths by moving codes down from the longest lengths while
+    // keeping the code complete
+    size_t bl_count[64] = {0};
+
+    for (size_t i = 0; i < count; i++)
+    {
+        bl_count[weight[i] > max_bits ? max_bits : weight[i]]++;
+    }
+
+    size_t total = 0;
+
+    for (size_t bits = 1; bits <= max_bits; bits++)
+    {
+        total += bl_count[bits] << (max_bits - bits);
+    }
+
+    while (total != ((size_t)1 << max_bits))
+    {
+        bl_count[max_bits]--;
+
+        for (size_t bits = max_bits - 1; bits > 0; bits--)
+        {
+            if (bl_count[bits])
+            {
+                bl_count[bits]--;
+                bl_count[bits + 1] += 2;
+                break;
+            }
+        }
+
+        total--;
+    }
+
+    // The least frequent symbols get the longest codes
+    size_t i = 0;
+
+    for (size_t bits = max_bits; bits > 0; bits--)
+    {
+        for (size_t j = 0; j < bl_count[bits]; j++)
+        {
+            lengths[order[i++]] = bits;
+        }
+    }
+}
+
+// Run length encode the literal/length and distance code lengths with the
+// code length alphabet, returns the number of symbols, with the extra bits of
+// each repeat stored alongside it
+static size_t encode_code_lengths(const uint8_t* lengths, size_t n, uint8_t* symbols, uint8_t* extra, size_t* freq)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < n;)
+    {
+        uint8_t value = lengths[i];
+        size_t run = 1;
+
+        while (i + run < n && lengths[i + run] == value)
+        {
+            run++;
+        }
+
+        i += run;
+
+        if (value == 0)
+        {
+            while (run >= 11)
+            {
+                size_t r = MIN(run, 138);
+                symbols[count] = 18;
+                extra[count++] = r - 11;
+                run -= r;
+            }
+
+            if (run >= 3)
+            {
+                symbols[count] = 17;
+                extra[count++] = run - 3;
+                run = 0;
+            }
+        }
+        else if (run >= 4)
+        {
+            symbols[count] = value;
+            extra[count++] = 0;
+            run--;
+
+            while (run >= 3)
+            {
+                size_t r = MIN(run, 6);
+                symbols[count] = 16;
+                extra[count++] = r - 3;
+                run -= r;
+            }
+        }
+
+        while (run--)
+        {
+            symbols[count] = value;
+            extra[count++] = 0;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        freq[symbols[i]]++;
+    }
+
+    return count;
+}
+
+// Number of bits the symbols of the block take with the given lengths
+static size_t symbol_cost(struct deflate_state* s, const uint8_t* lit_len_lengths, const uint8_t* dist_lengths)
+{
+    size_t bits = 0;
+
+    for (size_t i = 0; i < LIT_LEN_CODES; i++)
+    {
+        bits += s->lit_len_freq[i] * (lit_len_lengths[i] + (i > 256 ? LengthExtraBits[i - 257] : 0));
+    }
+
+    for (size_t i = 0; i < DIST_CODES; i++)
+    {
+        bits += s->dist_freq[i] * (dist_lengths[i] + DistanceExtraBits[i]);
+    }
+
+    return bits;
+}
+
+// Write out the symbols of the block with the given codes
+static void write_symbols(struct deflate_state* s, const struct block_codes* codes)
+{
+    for (size_t i = 0; i < s->symbol_count; i++)
+    {
+        struct deflate_symbol sym = s->symbols[i];
+
+        if (sym.distance == 0)
+        {
+            put_bits(s, codes->lit_len_codes[sym.value], codes->lit_len_lengths[sym.value]);
+            continue;
+        }
+
+        size_t code = s->length_code[sym.value];
+        put_bits(s, codes->lit_len_codes[257 + code], codes->lit_len_lengths[257 + code]);
+
+        if (LengthExtraBits[code])
+        {
+            put_bits(s, sym.value + 3 - LengthBase[code], LengthExtraBits[code]);
+        }
+
+        code = distance_symbol(s, sym.distance);
+        put_bits(s, codes->dist_codes[code], codes->dist_lengths[code]);
+
+        if (DistanceExtraBits[code])
+        {
+            put_bits(s, sym.distance - DistanceBase[code], DistanceExtraBits[code]);
+        }
+    }
+
+    put_bits(s, codes->lit_len_codes[256], codes->lit_len_lengths[256]);
+}
+
+// Emit the symbols gathered since block_start as a stored, fixed or dynamic
+// block, whichever is smallest
+static void flush_block(struct deflate_state* s, uint8_t last)
+{
+    s->lit_len_freq[256]++;
+
+    // Fixed codes
+    static struct block_codes fixed;
+    static uint8_t fixed_ready = 0;
+
+    if (!fixed_ready)
+    {
+        for (size_t i = 0; i < 288; i++)
+        {
+            fixed.lit_len_lengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+        }
+
+        for (size_t i = 0; i < 32; i++)
+        {
+            fixed.dist_lengths[i] = 5;
+        }
+
+        build_codes(fixed.lit_len_lengths, fixed.lit_len_codes, 288);
+        build_codes(fixed.dist_lengths, fixed.dist_codes, 32);
+
+        fixed_ready = 1;
+    }
+
+    // Dynamic codes fitted to this block
+    struct block_codes dynamic;
+    build_lengths(s->lit_len_freq, LIT_LEN_CODES, 15, dynamic.lit_len_lengths);
+    build_lengths(s->dist_freq, DIST_CODES, 15, dynamic.dist_lengths);
+    build_codes(dynamic.lit_len_lengths, dynamic.lit_len_codes, LIT_LEN_CODES);
+    build_codes(dynamic.dist_lengths, dynamic.dist_codes, DIST_CODES);
+
+    size_t hlit = LIT_LEN_CODES;
+    while (hlit > 257 && dynamic.lit_len_lengths[hlit - 1] == 0) hlit--;
+
+    size_t hdist = DIST_CODES;
+    while (hdist > 1 && dynamic.dist_lengths[hdist - 1] == 0) hdist--;
+
+    uint8_t all_lengths[LIT_LEN_CODES + DIST_CODES];
+    memcpy(all_lengths, dynamic.lit_len_lengths, hlit);
+    memcpy(all_lengths + hlit, dynamic.dist_lengths, hdist);
+
+    uint8_t cl_symbols[LIT_LEN_CODES + DIST_CODES];
+    uint8_t cl_extra[LIT_LEN_CODES + DIST_CODES];
+    size_t cl_freq[CODE_LEN_CODES] = {0};
+    size_t cl_count = encode_code_lengths(all_lengths, hlit + hdist, cl_symbols, cl_extra, cl_freq);
+
+    uint8_t cl_lengths[CODE_LEN_CODES];
+    uint16_t cl_codes[CODE_LEN_CODES];
+    build_lengths(cl_freq, CODE_LEN_CODES, 7, cl_lengths);
+    build_codes(cl_lengths, cl_codes, CODE_LEN_CODES);
+
+    size_t hclen = CODE_LEN_CODES;
+    while (hclen > 4 && cl_lengths[CodeLengthCodesOrder[hclen - 1]] == 0) hclen--;
+
+    // Work out the size of each kind of block
+    size_t dynamic_bits = 3 + 14 + 3 * hclen + symbol_cost(s, dynamic.lit_len_lengths, dynamic.dist_lengths);
+
+    for (size_t i = 0; i < cl_count; i++)
+    {
+        dynamic_bits += cl_lengths[cl_symbols[i]] + (cl_symbols[i] == 16 ? 2 : (cl_symbols[i] == 17 ? 3 : (cl_symbols[i] == 18 ? 7 : 0)));
+    }
+
+    size_t fixed_bits = 3 + symbol_cost(s, fixed.lit_len_lengths, fixed.dist_lengths);
+
+    size_t stored_length = s->strstart - s->block_start;
+    size_t stored_bits = (size_t)-1;
+
+    // A stored block needs the original data, which is gone if the window
+    // slid during the block
+    if (s->block_start >= 0)
+    {
+        stored_bits = 3 + (8 - (s->bit_count + 3) % 8) % 8 + 32 + 8 * stored_length;
+    }
+
+    if (s->level == 0 || (stored_bits <= fixed_bits && stored_bits <= dynamic_bits))
+    {
+        // A stored block holds at most 65535 bytes, so a full window is
+        // split over two of them
+        const uint8_t* data = s->window + s->block_start;
+
+        do
+        {
+            size_t length = MIN(stored_length, 65535);
+            stored_length -= length;
+
+            put_bits(s, last && stored_length == 0, 1);
+            put_bits(s, NOCOMPRESSION, 2);
+            flush_bits(s);
+
+            put_bits(s, length, 16);
+            put_bits(s, (uint16_t)~length, 16);
+            flush_bits(s);
+
+            reserve_buffer(&s->out, length);
+            memcpy(s->out.buf + s->out.index, data, length);
+            s->out.index += length;
+            data += length;
+        } while (stored_length > 0);
+    }
+    else if (fixed_bits <= dynamic_bits)
+    {
+        put_bits(s, last, 1);
+        put_bits(s, FIXEDCOMPRESSION, 2);
+        write_symbols(s, &fixed);
+    }
+    else
+    {
+        put_bits(s, last, 1);
+        put_bits(s, DYNAMICCOMPRESSION, 2);
+        put_bits(s, hlit - 257, 5);
+        put_bits(s, hdist - 1, 5);
+        put_bits(s, hclen - 4, 4);
+
+        for (size_t i = 0; i < hclen; i++)
+        {
+            put_bits(s, cl_lengths[CodeLengthCodesOrder[i]], 3);
+        }
+
+        for (size_t i = 0; i < cl_count; i++)
+        {
+            uint8_t sym = cl_symbols[i];
+            put_bits(s, cl_codes[sym], cl_lengths[sym]);
+
+            if (sym >= 16)
+            {
+                put_bits(s, cl_extra[i], sym == 16 ? 2 : (sym == 17 ? 3 : 7));
+            }
+        }
+
+        write_symbols(s, &dynamic);
+    }
+
+    if (last)
+    {
+        flush_bits(s);
+    }
+
+    // Start the next block
+    s->block_start = s->strstart;
+    s->symbol_count = 0;
+    memset(s->lit_len_freq, 0, sizeof(s->lit_len_freq));
+    memset(s->dist_freq, 0, sizeof(s->dist_freq));
+}
+
+// Record a literal, returns 1 once the symbol buffer is full
+static inline uint8_t tally_literal(struct deflate_state* s, uint8_t byte)
+{
+    s->symbols[s->symbol_count++] = (struct deflate_symbol){.value = byte, .distance = 0};
+    s->lit_len_freq[byte]++;
+
+    return s->symbol_count == SYMBOL_BUFFER_SIZE;
+}
+
+// Record a match, returns 1 once the symbol buffer is full
+static inline uint8_t tally_match(struct deflate_state* s, size_t length, size_t distance)
+{
+    s->symbols[s->symbol_count++] = (struct deflate_symbol){.value = length - MIN_MATCH, .distance = distance};
+    s->lit_len_freq[257 + s->length_code[length - MIN_MATCH]]++;
+    s->dist_freq[distance_symbol(s, distance)]++;
+
+    return s->symbol_count == SYMBOL_BUFFER_SIZE;
+}
+
+// Add the string starting at pos to the hash chains, returns the previous
+// head of its chain
+static inline size_t insert_string(struct deflate_state* s, size_t pos)
+{
+    size_t hash = (((size_t)s->window[pos] << 10) ^ ((size_t)s->window[pos + 1] << 5) ^ s->window[pos + 2]) & HASH_MASK;
+    size_t head = s->head[hash];
+
+    s->prev[pos & WINDOW_MASK] = head;
+    s->head[hash] = pos;
+
+    return head;
+}
+
+// Find the longest match for the string at strstart along the chain starting
+// at cur_match, only matches longer than prev_length are accepted
+static size_t longest_match(struct deflate_state* s, size_t cur_match)
+{
+    size_t chain = s->config.max_chain;
+    size_t best_length = s->prev_length;
+    size_t max_length = MIN(MAX_MATCH, s->lookahead);
+    size_t nice_length = MIN(s->config.nice_length, max_length);
+    size_t limit = s->strstart > MAX_DIST ? s->strstart - MAX_DIST : 0;
+    uint8_t* scan = s->window + s->strstart;
+
+    if (best_length >= max_length)
+    {
+        return best_length;
+    }
+
+    if (s->prev_length >= s->config.good_length)
+    {
+        chain >>= 2;
+    }
+
+    do
+    {
+        uint8_t* match = s->window + cur_match;
+
+        // Check the byte which would make this match better first
+        if (match[best_length] != scan[best_length] || match[0] != scan[0] || match[1] != scan[1])
+        {
+            continue;
+        }
+
+        size_t length = 2;
+
+        while (length < max_length && match[length] == scan[length])
+        {
+            length++;
+        }
+
+        if (length > best_length)
+        {
+            s->match_start = cur_match;
+            best_length = length;
+
+            if (length >= nice_length)
+            {
+                break;
+            }
+        }
+    } while ((cur_match = s->prev[cur_match & WINDOW_MASK]) > limit && --chain != 0);
+
+    return best_length;
+}
+
+// Compress without deferring matches, used by the fastest levels
+static void compress_greedy(struct deflate_state* s, uint8_t flush)
+{
+    while (s->lookahead >= MIN_LOOKAHEAD || (flush && s->lookahead > 0))
+    {
+        size_t hash_head = s->lookahead >= MIN_MATCH ? insert_string(s, s->strstart) : 0;
+
+        s->match_length = MIN_MATCH - 1;
+
+        if (hash_head != 0 && s->strstart - hash_head <= MAX_DIST)
+        {
+            s->prev_length = MIN_MATCH - 1;
+            s->match_length = longest_match(s, hash_head);
+        }
+
+        uint8_t full;
+
+        if (s->match_length >= MIN_MATCH)
+        {
+            full = tally_match(s, s->match_length, s->strstart - s->match_start);
+            s->lookahead -= s->match_length;
+
+            // Only short matches have every string within them hashed
+            if (s->match_length <= s->config.max_lazy && s->lookahead >= MIN_MATCH)
+            {
+                size_t max_insert = s->strstart + s->match_length + s->lookahead - MIN_MATCH;
+
+                for (size_t i = 1; i < s->match_length; i++)
+                {
+                    if (s->strstart + i <= max_insert)
+                    {
+                        insert_string(s, s->strstart + i);
+                    }
+                }
+            }
+
+            s->strstart += s->match_length;
+        }
+        else
+        {
+            full = tally_literal(s, s->window[s->strstart]);
+            s->lookahead--;
+            s->strstart++;
+        }
+
+        if (full)
+        {
+            flush_block(s, 0);
+        }
+    }
+}
+
+// Compress with lazy matching, each match is only taken if the next position
+// does not start a longer one
+static void compress_lazy(struct deflate_state* s, uint8_t flush)
+{
+    while (s->lookahead >= MIN_LOOKAHEAD || (flush && s->lookahead > 0))
+    {
+        size_t hash_head = s->lookahead >= MIN_MATCH ? insert_string(s, s->strstart) : 0;
+
+        s->prev_length = s->match_length;
+        s->prev_match = s->match_start;
+        s->match_length = MIN_MATCH - 1;
+
+        if (hash_head != 0 && s->prev_length < s->config.max_lazy && s->strstart - hash_head <= MAX_DIST)
+        {
+            s->match_length = longest_match(s, hash_head);
+
+            if (s->match_length == MIN_MATCH && s->strstart - s->match_start > TOO_FAR)
+            {
+                s->match_length = MIN_MATCH - 1;
+            }
+        }
+
+        if (s->prev_length >= MIN_MATCH && s->match_length <= s->prev_length)
+        {
+            // The match at the previous position wins
+            size_t max_insert = s->strstart + s->lookahead - MIN_MATCH;
+            uint8_t full = tally_match(s, s->prev_length, s->strstart - 1 - s->prev_match);
+
+            s->lookahead -= s->prev_length - 1;
+
+            for (size_t i = 0; i < s->prev_length - 2; i++)
+            {
+                if (++s->strstart <= max_insert)
+                {
+                    insert_string(s, s->strstart);
+                }
+            }
+
+            s->match_available = 0;
+            s->match_length = MIN_MATCH - 1;
+            s->strstart++;
+
+            if (full)
+            {
+                flush_block(s, 0);
+            }
+        }
+        else if (s->match_available)
+        {
+            // The previous position becomes a literal, and this one waits
+            if (tally_literal(s, s->window[s->strstart - 1]))
+            {
+                flush_block(s, 0);
+            }
+
+            s->strstart++;
+            s->lookahead--;
+        }
+        else
+        {
+            s->match_available = 1;
+            s->strstart++;
+            s->lookahead--;
+        }
+    }
+
+    if (flush && s->match_available)
+    {
+        tally_literal(s, s->window[s->strstart - 1]);
+        s->match_available = 0;
+    }
+}
+
+// Move the upper half of the window down to make room for more input
+static void slide_window(struct deflate_state* s)
+{
+    // Stored blocks need the whole block in the window
+    if (s->level == 0 && (long)s->strstart > s->block_start)
+    {
+        flush_block(s, 0);
+    }
+
+    memcpy(s->window, s->window + WINDOW_SIZE, WINDOW_SIZE);
+    s->strstart -= WINDOW_SIZE;
+    s->match_start -= WINDOW_SIZE;
+    s->block_start -= WINDOW_SIZE;
+
+    for (size_t i = 0; i < HASH_SIZE; i++)
+    {
+        s->head[i] = s->head[i] >= WINDOW_SIZE ? s->head[i] - WINDOW_SIZE : 0;
+    }
+
+    for (size_t i = 0; i < WINDOW_SIZE; i++)
+    {
+        s->prev[i] = s->prev[i] >= WINDOW_SIZE ? s->prev[i] - WINDOW_SIZE : 0;
+    }
+}
+
+// Allocate the state for a new compression at the given level (0 stores the
+// data uncompressed, 1 is the fastest and 9 gives the smallest output),
+// returns a null pointer if the allocation fails
+struct deflate_state* deflate_init(int level)
+{
+    if (level < 0 || level > 9)
+    {
+        level = DEFLATE_LEVEL_DEFAULT;
+    }
+
+    struct deflate_state* s = zip_malloc(sizeof(struct deflate_state));
+
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    s->level = level;
+    s->config = Levels[level];
+
+    s->strstart = 0;
+    s->lookahead = 0;
+    s->block_start = 0;
+
+    memset(s->head, 0, sizeof(s->head));
+    memset(s->prev, 0, sizeof(s->prev));
+
+    s->match_length = MIN_MATCH - 1;
+    s->match_start = 0;
+    s->prev_length = MIN_MATCH - 1;
+    s->prev_match = 0;
+    s->match_available = 0;
+
+    s->symbol_count = 0;
+    memset(s->lit_len_freq, 0, sizeof(s->lit_len_freq));
+    memset(s->dist_freq, 0, sizeof(s->dist_freq));
+
+    // Build the lookups from match lengths and distances to their symbols
+    for (size_t code = 0; code < 29; code++)
+    {
+        for (size_t i = 0; i < ((size_t)1 << LengthExtraBits[code]); i++)
+        {
+            size_t length = LengthBase[code] + i;
+
+            if (length <= MAX_MATCH)
+            {
+                s->length_code[length - MIN_MATCH] = code;
+            }
+        }
+    }
+
+    for (size_t code = 0; code < 30; code++)
+    {
+        for (size_t i = 0; i < ((size_t)1 << DistanceExtraBits[code]); i++)
+        {
+            size_t distance = DistanceBase[code] + i;
+
+            if (distance <= 256)
+            {
+                s->dist_code[distance - 1] = code;
+            }
+            else
+            {
+                s->dist_code[256 + ((distance - 1) >> 7)] = code;
+            }
+        }
+    }
+
+    s->out = new_exp_buffer(4096);
+    s->bit_buffer = 0;
+    s->bit_count = 0;
+    s->finished = 0;
+
+    if (s->out.buf == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+// Compress the input, which is always consumed completely. Once final is set
+// the stream is finished and no more input can be given. A pointer to the
+// compressed bytes produced by this call is stored in output, which stays
+// valid until the next call. Returns 0 on success and -1 on failure.
+int deflate_feed(struct deflate_state* s, const void* input, size_t in_length, int final, const uint8_t** output, size_t* out_length)
+{
+    const uint8_t* in = input;
+
+    s->out.index = 0;
+
+    if (s->finished)
+    {
+        return in_length == 0 ? 0 : -1;
+    }
+
+    for (;;)
+    {
+        // Make room once the lookahead reaches the end of the window
+        if (s->strstart >= 2 * WINDOW_SIZE - MIN_LOOKAHEAD)
+        {
+            slide_window(s);
+        }
+
+        // Copy as much input into the window as fits
+        size_t end = s->strstart + s->lookahead;
+        size_t count = MIN(in_length, 2 * WINDOW_SIZE - end);
+
+        memcpy(s->window + end, in, count);
+        s->lookahead += count;
+        in += count;
+        in_length -= count;
+
+        uint8_t flush = final && in_length == 0;
+
+        if (s->level == 0)
+        {
+            s->strstart += s->lookahead;
+            s->lookahead = 0;
+        }
+        else if (s->config.lazy)
+        {
+            compress_lazy(s, flush);
+        }
+        else
+        {
+            compress_greedy(s, flush);
+        }
+
+        if (in_length == 0)
+        {
+            break;
+        }
+    }
+
+    if (final)
+    {
+        flush_block(s, 1);
+        s->finished = 1;
+    }
+
+    *output = s->out.buf;
+    *out_length = s->out.index;
+
+    return 0;
+}
+
+// Free the state of a compression
+void deflate_end(struct deflate_state* s)
+{
+    free(s->out.buf);
+    free(s);
+}
+
+// Compress data in the DEFLATE format at the given level, this will return a
+// buffer which needs to be free()ed at a later point to avoid a memory leak,
+// this function will return a null pointer if the compression fails.
+uint8_t* deflate_compress(const void* data, size_t length, int level, size_t* out_length)
+{
+    struct deflate_state* s = deflate_init(level);
+
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    const uint8_t* output;
+
+    if (deflate_feed(s, data, length, 1, &output, out_length))
+    {
+        deflate_end(s);
+        return NULL;
+    }
+
+    // Hand the output buffer over to the caller
+    uint8_t* result = s->out.buf;
+    free(s);
+
+    return result;
+}
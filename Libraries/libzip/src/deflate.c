@@ -7,6 +7,7 @@
 
 #include "bitstream.h"
 #include "buf.h"
+#include "deflate.h"
 #include "huffman.h"
 
 // #define DEBUG_MSG(...) printf("  [DEBUG] "__VA_ARGS__)
@@ -17,107 +18,219 @@
     Much of this code has been adapted from this blog post https://pyokagan.name/blog/2019-10-18-zlibinflate/ and converted from python to C
 */
 
-static size_t LengthExtraBits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
-static size_t LengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
-static size_t DistanceExtraBits[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
-static size_t DistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const size_t LengthExtraBits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const size_t LengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const size_t DistanceExtraBits[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const size_t DistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const size_t CodeLengthCodesOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
 
-static struct huffman_node* default_lit_len_tree;
-static struct huffman_node* default_dist_tree;
+// Lookup tables for the fixed huffman codes, which are generated when the
+// library is built
+#include "fixed_tables.h"
 
-void init_default_trees()
+// Decompress a single block, returns 1 after the final block, 0 if more blocks
+// follow, and -1 on failure
+int decompress_block(struct bitstream* stream, struct exp_buffer* buf, struct dynamic_tables* tables);
+
+// Decompress blocks until the final one, keeping the Adler-32 of the output up
+// to date after each block if adler is not a null pointer. Returns 1 on
+// success and -1 on failure.
+static int decompress_blocks(struct bitstream* stream, struct exp_buffer* buf, uint32_t* adler);
+
+// Decompress a non-compressed block
+uint8_t decompress_non_compressed_block(struct bitstream* stream, struct exp_buffer* buf);
+
+uint8_t decompress_default_compressed_block(struct bitstream* stream, struct exp_buffer* buf);
+
+// Decompress a block compressed with dynamic huffman codings
+uint8_t decompress_dynamic_compressed_block(struct bitstream* stream, struct exp_buffer* buf, struct dynamic_tables* tables);
+
+// Decompress data stored in the DEFLATE format, this will return a buffer
+// which needs to be free()ed at a later point to avoid a memory leak, this
+// function will return a null pointer if the decompression fails.
+uint8_t* deflate_decompress(void* data, size_t* length)
+{
+    // Without a known input length the reader may load up to a word past the
+    // end of the compressed data
+    return deflate_decompress_bounded(data, (size_t)-1, length);
+}
+
+// Decompress in_length bytes of data stored in the DEFLATE format, this will
+// return a buffer which needs to be free()ed at a later point to avoid a
+// memory leak, this function will return a null pointer if the decompression
+// fails or the data is truncated.
+uint8_t* deflate_decompress_bounded(const void* data, size_t in_length, size_t* length)
+{
+    return deflate_decompress_sized(data, in_length, 0, length);
+}
+
+// Decompress in_length bytes of data stored in the DEFLATE format, with the
+// output buffer allocated up front to hold expected bytes (it still grows if
+// the output turns out to be larger). This will return a buffer which needs to
+// be free()ed at a later point to avoid a memory leak, this function will
+// return a null pointer if the decompression fails or the data is truncated.
+uint8_t* deflate_decompress_sized(const void* data, size_t in_length, size_t expected, size_t* length)
 {
-    static uint8_t done = 0;
-    if (!done)
+    DEBUG_MSG("Attempting to decompress data.\n");
+
+    // Convert the pointer to a bit stream
+    DEBUG_MSG("Converting to bit stream\n");
+    struct bitstream stream;
+    bitstream_init(&stream, data, in_length);
+
+    // Return data buffer
+    struct exp_buffer result = new_exp_buffer(expected ? expected : 1024);
+
+    if (result.buf == NULL || decompress_blocks(&stream, &result, NULL) < 0 || stream.overrun)
     {
-        uint8_t bl[288];
-        uint16_t alphabet[288];
-        
-        size_t i = 0;
+        free(result.buf);
+        return NULL;
+    }
 
-        for (; i < 144; i++)
-        {
-            bl[i] = 8;
-            alphabet[i] = i;
-        }
+    *length = result.index;
+    return result.buf;
+}
 
-        for (; i < 256; i++)
-        {
-            bl[i] = 9;
-            alphabet[i] = i;
-        }
+// Decompress in_length bytes of data stored in the DEFLATE format into a
+// buffer owned by the caller, storing the number of bytes written in length.
+// Returns 0 on success, and -1 if the decompression fails or the output does
+// not fit in out_length bytes.
+int deflate_decompress_into(const void* data, size_t in_length, void* output, size_t out_length, size_t* length)
+{
+    struct bitstream stream;
+    bitstream_init(&stream, data, in_length);
 
-        for (; i < 280; i++)
-        {
-            bl[i] = 7;
-            alphabet[i] = i;
-        }
+    struct exp_buffer result = fixed_exp_buffer(output, out_length);
+
+    if (decompress_blocks(&stream, &result, NULL) < 0 || stream.overrun)
+    {
+        return -1;
+    }
+
+    *length = result.index;
+    return 0;
+}
+
+// Decompress a zlib stream into the buffer, returns 0 on success and -1 on
+// failure
+static int zlib_decompress_buffer(const void* data, size_t in_length, struct exp_buffer* result, int verify)
+{
+    const uint8_t* bytes = data;
+
+    // The header must use DEFLATE with at most a 32 KiB window, and no preset
+    // dictionary
+    if (in_length < 2 || (bytes[0] & 0x0F) != CM_DEFLATE || (bytes[0] >> 4) > 7 || ((bytes[0] << 8) | bytes[1]) % 31 != 0 || (bytes[1] & 0x20))
+    {
+        printf("Invalid zlib header\n");
+        return -1;
+    }
+
+    struct bitstream stream;
+    bitstream_init(&stream, bytes + 2, in_length - 2);
+
+    uint32_t adler = 1;
+
+    if (decompress_blocks(&stream, result, verify ? &adler : NULL) < 0 || stream.overrun)
+    {
+        return -1;
+    }
+
+    if (verify)
+    {
+        flush_to_next_byte(&stream);
 
-        for (; i < 288; i++)
+        uint32_t expected = 0;
+
+        for (size_t i = 0; i < 4; i++)
         {
-            bl[i] = 8;
-            alphabet[i] = i;
+            expected = (expected << 8) | read_byte(&stream);
         }
 
-        default_lit_len_tree = huffman_from_bit_lengths(bl, alphabet, 286);
-
-        for (size_t i = 0; i < 30; i++)
+        if (stream.overrun || expected != adler)
         {
-            bl[i] = 5;
+            printf("zlib checksum mismatch\n");
+            return -1;
         }
+    }
 
-        default_dist_tree = huffman_from_bit_lengths(bl, alphabet, 30);
+    return 0;
+}
+
+// Decompress in_length bytes of data stored in the zlib format (a DEFLATE
+// stream between a two byte header and an Adler-32 trailer), this will return
+// a buffer which needs to be free()ed at a later point to avoid a memory leak.
+// If verify is set the Adler-32 of the output must match the trailer. This
+// function will return a null pointer if the decompression fails.
+uint8_t* zlib_decompress(const void* data, size_t in_length, size_t* length, int verify)
+{
+    struct exp_buffer result = new_exp_buffer(1024);
 
-        done = 1;
+    if (result.buf == NULL || zlib_decompress_buffer(data, in_length, &result, verify))
+    {
+        free(result.buf);
+        return NULL;
     }
+
+    *length = result.index;
+    return result.buf;
 }
 
-// Block types
-enum blocktype
+// Decompress in_length bytes of data stored in the zlib format into a buffer
+// owned by the caller, storing the number of bytes written in length. If
+// verify is set the Adler-32 of the output must match the trailer. Returns 0
+// on success, and -1 if the decompression fails or the output does not fit in
+// out_length bytes.
+int zlib_decompress_into(const void* data, size_t in_length, void* output, size_t out_length, size_t* length, int verify)
 {
-    NOCOMPRESSION = 0b00,
-    FIXEDCOMPRESSION = 0b01,
-    DYNAMICCOMPRESSION = 0b10
-};
+    struct exp_buffer result = fixed_exp_buffer(output, out_length);
 
-// Decompress a single block
-uint8_t decompress_block(struct bitstream* stream, struct exp_buffer* buf);
+    if (zlib_decompress_buffer(data, in_length, &result, verify))
+    {
+        return -1;
+    }
 
-// Decompress a non-compressed block
-uint8_t decompress_non_compressed_block(struct bitstream* stream, struct exp_buffer* buf);
+    *length = result.index;
+    return 0;
+}
 
-uint8_t decompress_default_compressed_block(struct bitstream* stream, struct exp_buffer* buf);
+// Decompress blocks until the final one, keeping the Adler-32 of the output up
+// to date after each block if adler is not a null pointer. Returns 1 on
+// success and -1 on failure.
+static int decompress_blocks(struct bitstream* stream, struct exp_buffer* buf, uint32_t* adler)
+{
+    // The tables are shared by every block, so the number of allocations made
+    // does not depend on the number of blocks
+    struct dynamic_tables* tables = zip_malloc(sizeof(struct dynamic_tables));
 
-// Decompress a block compressed with dynamic huffman codings
-uint8_t decompress_dynamic_compressed_block(struct bitstream* stream, struct exp_buffer* buf);
+    if (tables == NULL)
+    {
+        return -1;
+    }
 
-// Decompress data stored in the DEFLATE format, this will return a buffer
-// which needs to be free()ed at a later point to avoid a memory leak, this
-// function will return a null pointer if the decompression fails.
-uint8_t* deflate_decompress(void* data, size_t* length)
-{
-    init_default_trees();
-    DEBUG_MSG("Attempting to decompress data.\n");
+    int status;
 
-    // Convert the pointer to a bit stream
-    DEBUG_MSG("Converting to bit stream\n");
-    struct bitstream stream = (struct bitstream){.ptr = data, .byte = 0, .bit = 0};
+    do
+    {
+        size_t start = buf->index;
+        status = decompress_block(stream, buf, tables);
 
-    // Return data buffer
-    struct exp_buffer result = new_exp_buffer(1024);
+        if (adler != NULL && status >= 0)
+        {
+            *adler = adler32_update(*adler, buf->buf + start, buf->index - start);
+        }
+    } while (status == 0);
 
-    // While there is still data to decompress, continue doing so
-    while (!decompress_block(&stream, &result));
+    free(tables);
 
-    *length = result.index;
-    return result.buf;
+    return status;
 }
 
 
-// Decompress a single block
-uint8_t decompress_block(struct bitstream* stream, struct exp_buffer* buf)
+// Decompress a single block, returns 1 after the final block, 0 if more blocks
+// follow, and -1 on failure
+int decompress_block(struct bitstream* stream, struct exp_buffer* buf, struct dynamic_tables* tables)
 {
-    DEBUG_MSG("Decompressing block at byte %ld, bit %ld\n", stream->byte, stream->bit);
+    DEBUG_MSG("Decompressing block at bit %ld\n", stream->byte * 8 - stream->count);
 
     // Get the final block flag
     uint8_t final = read_bit(stream);
@@ -125,25 +238,31 @@ uint8_t decompress_block(struct bitstream* stream, struct exp_buffer* buf)
     // Get the block type
     enum blocktype block_type = read_bits(stream, 2);
 
+    uint8_t result;
+
     // Decompress the proper kind of block
     switch (block_type)
     {
         case NOCOMPRESSION:
-            decompress_non_compressed_block(stream, buf);
+            result = decompress_non_compressed_block(stream, buf);
             break;
 
         case FIXEDCOMPRESSION:
-            decompress_default_compressed_block(stream, buf);
+            result = decompress_default_compressed_block(stream, buf);
             break;
 
         case DYNAMICCOMPRESSION:
-            decompress_dynamic_compressed_block(stream, buf);
+            result = decompress_dynamic_compressed_block(stream, buf, tables);
             break;
 
         default: 
             printf("Unknown block type: %x\n", block_type);
-            assert(0);
-            break;
+            return -1;
+    }
+
+    if (result)
+    {
+        return -1;
     }
 
     return final;
@@ -153,68 +272,203 @@ uint8_t decompress_block(struct bitstream* stream, struct exp_buffer* buf)
 // Decompress a non-compressed block
 uint8_t decompress_non_compressed_block(struct bitstream* stream, struct exp_buffer* buf)
 {
+    // The lengths start at the next byte boundary
+    flush_to_next_byte(stream);
+
     // Extract the length and negated lengths
     uint16_t len = read_short(stream);
     uint16_t nlen = read_short(stream);
 
     // Make sure the length and negated length match
-    if (len != ~nlen)
+    if (len != (uint16_t)~nlen)
     {
         printf("LEN and NLEN do not match:\n  Len: %x\n NLen: %x\n", len, nlen);
-        assert(0);
+        return 1;
     }
 
     // Copy bytes over to the expandable buffer
-    for (size_t i = 0; i < len; i++)
+    if (reserve_buffer(buf, len))
+    {
+        printf("Output buffer is full\n");
+        return 1;
+    }
+
+    if (read_bytes(stream, buf->buf + buf->index, len) != len)
     {
-        append_byte_to_buffer(buf, read_byte(stream));
+        printf("Stored block runs past the end of the input\n");
+        return 1;
     }
 
+    buf->index += len;
+
     return 0;
 }
 
-// Decompress a compressed block with the given trees
-uint8_t decompress_compressed_with(struct bitstream* stream, struct huffman_node* lit_len_tree, struct huffman_node* dist_tree, struct exp_buffer* buf)
+// Copy a match of length bytes from distance bytes back in the output, where
+// the two may overlap. Up to 8 bytes past the end of the match may be written,
+// so there must be room for length + 8 bytes.
+static inline void copy_match(uint8_t* out, size_t distance, size_t length)
 {
+    const uint8_t* from = out - distance;
+    uint8_t* end = out + length;
+
+    if (distance == 1)
+    {
+        // A run of a single byte
+        memset(out, *from, length);
+        return;
+    }
+
+    if (distance < 8)
+    {
+        // Build up the repeating pattern byte by byte until it is at least a
+        // word long, after which it can be copied a word at a time from a
+        // whole number of periods back
+        size_t period = distance * ((8 + distance - 1) / distance);
+
+        for (size_t i = 0; i < period && out < end; i++)
+        {
+            *out = *from;
+            out++;
+            from++;
+        }
+
+        from = out - period;
+    }
+
+    // The source is always at least a word behind, so each word copy reads
+    // only bytes which have already been written
+    while (out < end)
+    {
+        memcpy(out, from, 8);
+        out += 8;
+        from += 8;
+    }
+}
+
+// Decompress a compressed block with the given tables
+uint8_t decompress_compressed_with(struct bitstream* stream, const struct huffman_table* lit_len_table, const struct huffman_table* dist_table, struct exp_buffer* buf)
+{
+    // Room is reserved ahead of time, so only the pointers need comparing
+    // for each literal rather than calling into the buffer
+    uint8_t* out = buf->buf + buf->index;
+    uint8_t* limit = buf->buf + buf->size;
+
     // while True:
     for (;;)
     {
     //     sym = decode_symbol(r, literal_length_tree)
         uint16_t sym;
-        uint8_t result = huffman_decode(lit_len_tree, stream, &sym);
-        if (result) return result;
+        uint8_t result = huffman_decode_table(lit_len_table, stream, &sym);
+
+        if (result)
+        {
+            buf->index = out - buf->buf;
+            return result;
+        }
+
+        // Stop once the input has run out rather than decoding zeros forever
+        if (stream->overrun)
+        {
+            printf("Compressed data is truncated\n");
+            buf->index = out - buf->buf;
+            return 1;
+        }
 
     //     if sym <= 255: # Literal byte
         if (sym <= 255)
         {
+            if (out == limit)
+            {
+                // Grow the buffer, leaving enough room for a run of literals
+                buf->index = out - buf->buf;
+
+                if (reserve_buffer(buf, 1))
+                {
+                    printf("Output buffer is full\n");
+                    return 1;
+                }
+
+                out = buf->buf + buf->index;
+                limit = buf->buf + buf->size;
+            }
+
     //         out.append(sym)
-            append_byte_to_buffer(buf, (uint8_t)sym);
+            *out++ = (uint8_t)sym;
         }
-    
+
     //     elif sym == 256: # End of block
-        else if (sym == 256) return 0;
-    //         return
+        else if (sym == 256)
+        {
+            buf->index = out - buf->buf;
+            return 0;
+        }
     //     else: # <length, backward distance> pair
         else
         {
+            buf->index = out - buf->buf;
+
     //         sym -= 257
             sym -= 257;
+
+            if (sym >= 29)
+            {
+                printf("Bad length symbol %i\n", sym + 257);
+                return 1;
+            }
+
     //         length = r.read_bits(LengthExtraBits[sym]) + LengthBase[sym]
-            size_t length = (size_t)read_bits16(stream, LengthExtraBits[(size_t)sym]) + LengthBase[sym];
+            size_t length = (size_t)read_bits32(stream, LengthExtraBits[(size_t)sym]) + LengthBase[sym];
     //         dist_sym = decode_symbol(r, distance_tree)
             uint16_t dist_sym;
-            result = huffman_decode(dist_tree, stream, &dist_sym);
+            result = huffman_decode_table(dist_table, stream, &dist_sym);
             if (result) return result;
+
+            if (dist_sym >= 30)
+            {
+                printf("Bad distance symbol %i\n", dist_sym);
+                return 1;
+            }
+
     //         dist = r.read_bits(DistanceExtraBits[dist_sym]) + DistanceBase[dist_sym]
-            size_t dist = (size_t)read_bits16(stream, DistanceExtraBits[(size_t)dist_sym]) + DistanceBase[dist_sym];
-    //         for _ in range(length):
+            size_t dist = (size_t)read_bits32(stream, DistanceExtraBits[(size_t)dist_sym]) + DistanceBase[dist_sym];
 
-            for (size_t i = 0; i < length; i++)
+            if (dist > buf->index)
             {
+                printf("Distance %ld reaches before the start of the output\n", dist);
+                return 1;
+            }
+
+    //         for _ in range(length):
     //             out.append(out[-dist])
-                uint8_t b = buf->buf[buf->index - dist];
-                append_byte_to_buffer(buf, b);
+            if ((size_t)(limit - out) >= length + 8)
+            {
+                // Copy the whole match at once, with space for the word
+                // copies to run over the end
+                copy_match(out, dist, length);
+            }
+            else if ((size_t)(limit - out) >= length)
+            {
+                // A presized buffer may only have exactly enough room left, so
+                // finish it off a byte at a time rather than growing it
+                for (size_t i = 0; i < length; i++)
+                {
+                    out[i] = (out - dist)[i];
+                }
             }
+            else if (!reserve_buffer(buf, length + 8))
+            {
+                copy_match(buf->buf + buf->index, dist, length);
+            }
+            else
+            {
+                printf("Output buffer is full\n");
+                return 1;
+            }
+
+            buf->index += length;
+            out = buf->buf + buf->index;
+            limit = buf->buf + buf->size;
         }
     }
 }
@@ -222,14 +476,13 @@ uint8_t decompress_compressed_with(struct bitstream* stream, struct huffman_node
 // Decompress a block compressed with the default huffman codings
 uint8_t decompress_default_compressed_block(struct bitstream* stream, struct exp_buffer* buf)
 {
-    return decompress_compressed_with(stream, default_lit_len_tree, default_dist_tree, buf);
+    return decompress_compressed_with(stream, &default_lit_len_table, &default_dist_table, buf);
 }
 
-// Decode the trees stored at the beginning of dynamic compressed blocks
-uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** dist_tree, struct bitstream* stream)
+// Decode the trees stored at the beginning of dynamic compressed blocks into
+// lookup tables, with their entries kept in tables
+uint8_t decode_trees(struct huffman_table* lit_len_table, struct huffman_table* dist_table, struct dynamic_tables* tables, struct bitstream* stream)
 {
-    static size_t CodeLengthCodesOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-
     // # The number of literal/length codes
     // HLIT = r.read_bits(5) + 257
     size_t hlit = (size_t)read_bits16(stream, 5) + 257;
@@ -242,6 +495,12 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
     // HCLEN = r.read_bits(4) + 4
     size_t hclen = (size_t)read_bits16(stream, 4) + 4;
 
+    if (hlit > 286 || hdist > 30)
+    {
+        printf("Too many codes: HLIT %ld, HDIST %ld\n", hlit, hdist);
+        return 1;
+    }
+
     // # Read code lengths for the code length alphabet
     // code_length_tree_bl = [0 for _ in range(19)]
     uint8_t code_length_tree_bl[19];
@@ -261,15 +520,15 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
 
     // # Construct code length tree
     // code_length_tree = bl_list_to_tree(code_length_tree_bl, range(19))
-    uint16_t code_len_alphabet[19];
+    struct huffman_entry code_length_entries[HUFFMAN_CODE_LEN_ENTRIES];
+    struct huffman_table code_length_table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_CODE_LEN_ENTRIES, .bits = 0};
 
-    for (size_t i = 0; i < 19; i++)
+    if (huffman_table_from_bit_lengths(&code_length_table, code_length_entries, code_length_tree_bl, 19, HUFFMAN_CODE_LEN_ROOT))
     {
-        code_len_alphabet[i] = i;
+        printf("Bad code length code\n");
+        return 1;
     }
 
-    struct huffman_node* code_length_tree = huffman_from_bit_lengths(code_length_tree_bl, code_len_alphabet, 19);
-
     // # Read literal/length + distance code length list
     // bl = []
     uint8_t bit_lengths[286 + 30];
@@ -279,8 +538,8 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
     {
     //     sym = decode_symbol(r, code_length_tree)
         uint16_t sym;
-        uint8_t result = huffman_decode(code_length_tree, stream, &sym);
-        if (result) return result;
+        uint8_t result = huffman_decode_table(&code_length_table, stream, &sym);
+        if (result || stream->overrun) return 1;
 
     //     if 0 <= sym <= 15: # literal value
         if (0 <= sym && sym <= 15)
@@ -295,10 +554,22 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
     //         # copy the previous code length 3..6 times.
     //         # the next 2 bits indicate repeat length ( 0 = 3, ..., 3 = 6 )
     //         prev_code_length = bl[-1]
+            if (i == 0)
+            {
+                printf("Repeat with no previous code length\n");
+                return 1;
+            }
+
             uint8_t prev_code_length = bit_lengths[i - 1];
     //         repeat_length = r.read_bits(2) + 3
             size_t repeat_length = (size_t)read_bits16(stream, 2) + 3;
 
+            if (i + repeat_length > hlit + hdist)
+            {
+                printf("Code length repeat runs past the end\n");
+                return 1;
+            }
+
     //         bl.extend(prev_code_length for _ in range(repeat_length))
             i--;
             for (size_t j = 0; j < repeat_length; j++)
@@ -312,6 +583,12 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
     //         # repeat code length 0 for 3..10 times. (3 bits of length)
     //         repeat_length = r.read_bits(3) + 3
             size_t repeat_length = (size_t)read_bits16(stream, 3) + 3;
+
+            if (i + repeat_length > hlit + hdist)
+            {
+                printf("Code length repeat runs past the end\n");
+                return 1;
+            }
     //         bl.extend(0 for _ in range(repeat_length))
             i--;
             for (size_t j = 0; j < repeat_length; j++)
@@ -325,6 +602,12 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
     //         # repeat code length 0 for 11..138 times. (7 bits of length)
     //         repeat_length = r.read_bits(7) + 11
             size_t repeat_length = (size_t)read_bits16(stream, 7) + 11;
+
+            if (i + repeat_length > hlit + hdist)
+            {
+                printf("Code length repeat runs past the end\n");
+                return 1;
+            }
     //         bl.extend(0 for _ in range(repeat_length))
             i--;
             for (size_t j = 0; j < repeat_length; j++)
@@ -336,40 +619,41 @@ uint8_t decode_trees(struct huffman_node** lit_len_tree, struct huffman_node** d
         else
         {
             printf("Bad symbol %i\n", sym);
-            assert(0 && "Invalid Symbol");
+            return 1;
         }
     //         raise Exception('invalid symbol')
     }
 
-    uint16_t alphabet[286];
-
-    for (size_t i = 0; i < 286; i++)
-    {
-        alphabet[i] = i;
-    }
-
     // # Construct trees
     // literal_length_tree = bl_list_to_tree(bl[:HLIT], range(286))
-    *lit_len_tree = huffman_from_bit_lengths(bit_lengths, alphabet, hlit);
+    if (huffman_table_from_bit_lengths(lit_len_table, tables->lit_len_entries, bit_lengths, hlit, HUFFMAN_LIT_LEN_ROOT))
+    {
+        printf("Bad literal/length code\n");
+        return 1;
+    }
     // distance_tree = bl_list_to_tree(bl[HLIT:], range(30))
-    *dist_tree = huffman_from_bit_lengths(bit_lengths + hlit, alphabet, hdist);
+    if (huffman_table_from_bit_lengths(dist_table, tables->dist_entries, bit_lengths + hlit, hdist, HUFFMAN_DIST_ROOT))
+    {
+        printf("Bad distance code\n");
+        return 1;
+    }
     // return literal_length_tree, distance_tree
 
     return 0;
 }
 
 // Decompress a block compressed with dynamic huffman codings
-uint8_t decompress_dynamic_compressed_block(struct bitstream* stream, struct exp_buffer* buf)
+uint8_t decompress_dynamic_compressed_block(struct bitstream* stream, struct exp_buffer* buf, struct dynamic_tables* tables)
 {
-    struct huffman_node* lit_len_tree;
-    struct huffman_node* dist_tree;
-
-    decode_trees(&lit_len_tree, &dist_tree, stream);
+    struct huffman_table lit_len_table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_LIT_LEN_ENTRIES, .bits = 0};
+    struct huffman_table dist_table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_DIST_ENTRIES, .bits = 0};
 
-    uint8_t result = decompress_compressed_with(stream, lit_len_tree, dist_tree, buf);
+    uint8_t result = decode_trees(&lit_len_table, &dist_table, tables, stream);
 
-    huffman_free(lit_len_tree);
-    huffman_free(dist_tree);
+    if (!result)
+    {
+        result = decompress_compressed_with(stream, &lit_len_table, &dist_table, buf);
+    }
 
-    return 0;
+    return result;
 }
\ No newline at end of file
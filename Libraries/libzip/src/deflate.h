@@ -0,0 +1,39 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <libc/stdint.h>
+#include <libc/stddef.h>
+
+#include "huffman.h"
+
+// Block types
+enum blocktype
+{
+    NOCOMPRESSION = 0b00,
+    FIXEDCOMPRESSION = 0b01,
+    DYNAMICCOMPRESSION = 0b10
+};
+
+// Base values and extra bit counts for the length and distance symbols
+extern const size_t LengthExtraBits[29];
+extern const size_t LengthBase[29];
+extern const size_t DistanceExtraBits[30];
+extern const size_t DistanceBase[30];
+
+// Order in which the code length code lengths are stored
+extern const size_t CodeLengthCodesOrder[19];
+
+// Lookup tables for the fixed huffman codes
+extern const struct huffman_table default_lit_len_table;
+extern const struct huffman_table default_dist_table;
+
+// Lookup tables for the codes of a dynamic block. One of these is allocated
+// per stream and rebuilt for every dynamic block, rather than allocating new
+// tables for each block.
+struct dynamic_tables
+{
+    struct huffman_entry lit_len_entries[HUFFMAN_LIT_LEN_ENTRIES];
+    struct huffman_entry dist_entries[HUFFMAN_DIST_ENTRIES];
+};
+
+#endif // DEFLATE_H
@@ -0,0 +1,547 @@
+#include "libzip.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "buf.h"
+
+/*
+    A gzip index holds checkpoints spread through the compressed data, each of
+    which records the position of the start of a DEFLATE block (in bits, as
+    blocks are not byte aligned) along with the 32 KiB of output before it.
+    Decompression can be restarted from any checkpoint, so reading from an
+    offset only needs to decompress from the nearest checkpoint before it.
+
+    The index can be saved to a sidecar file, which is laid out as (all values
+    little endian):
+
+        "GZIX" version:u32 compressed_length:u64 trailer:u64 total_out:u64
+        count:u32 count * (in_bit:u64 out:u64 window_length:u32
+        window[window_length])
+
+    The trailer is the last 8 bytes of the compressed data (the crc and length
+    of the last member), which together with the length catches a file which
+    has been rewritten since the index was saved, even at the same length.
+*/
+
+#define INDEX_MAGIC "GZIX"
+#define INDEX_VERSION 2
+
+// Largest amount of output a DEFLATE match can refer back to
+#define INDEX_WINDOW_SIZE 32768
+
+struct gzip_index_point
+{
+    // Position of the start of the block in the compressed data
+    uint64_t in_bit;
+
+    // Offset of the first byte of the block in the decompressed data
+    uint64_t out;
+
+    uint32_t window_length;
+    uint8_t* window;
+};
+
+struct gzip_index
+{
+    // Length and last 8 bytes of the compressed data the index was built from
+    uint64_t compressed_length;
+    uint64_t trailer;
+    uint64_t total_out;
+
+    size_t count;
+    size_t capacity;
+    struct gzip_index_point* points;
+};
+
+struct gzip_reader
+{
+    struct inflate_state* state;
+
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+
+    // Output still to be thrown away before the requested offset is reached
+    uint64_t skip;
+    uint8_t done;
+};
+
+// Read a little endian 32 bit value
+static uint32_t read_u32(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Read the last 8 bytes of the compressed data as a little endian value, or 0
+// if there are fewer than 8
+static uint64_t read_trailer(const uint8_t* bytes, size_t length)
+{
+    if (length < 8)
+    {
+        return 0;
+    }
+
+    return read_u32(bytes + length - 8) | ((uint64_t)read_u32(bytes + length - 4) << 32);
+}
+
+// Add a checkpoint at the current position of the decompression, returns 0 on
+// success and -1 if the allocation fails
+static int add_point(struct gzip_index* index, struct inflate_state* state, uint64_t in_bit, uint64_t out)
+{
+    if (index->count == index->capacity)
+    {
+        size_t capacity = index->capacity ? index->capacity * 2 : 16;
+        struct gzip_index_point* points = zip_realloc(index->points, capacity * sizeof(struct gzip_index_point));
+
+        if (points == NULL)
+        {
+            return -1;
+        }
+
+        index->points = points;
+        index->capacity = capacity;
+    }
+
+    struct gzip_index_point* point = &index->points[index->count];
+    point->window = zip_malloc(INDEX_WINDOW_SIZE);
+
+    if (point->window == NULL)
+    {
+        return -1;
+    }
+
+    point->in_bit = in_bit;
+    point->out = out;
+    point->window_length = inflate_window(state, point->window);
+
+    index->count++;
+
+    return 0;
+}
+
+// Build an index of the gzip data held in memory, with a checkpoint at the
+// first block boundary after every span bytes of output. Every member of the
+// file is decompressed (and its crc checked) once. Returns a null pointer if
+// the data is not valid gzip data or an allocation fails.
+struct gzip_index* gzip_index_build(const void* data, size_t length, size_t span)
+{
+    const uint8_t* bytes = data;
+
+    struct gzip_index* index = zip_malloc(sizeof(struct gzip_index));
+    uint8_t* output = zip_malloc(INDEX_WINDOW_SIZE);
+
+    if (index == NULL || output == NULL)
+    {
+        free(index);
+        free(output);
+        return NULL;
+    }
+
+    *index = (struct gzip_index){.compressed_length = length, .trailer = read_trailer(bytes, length), .total_out = 0, .count = 0, .capacity = 0, .points = NULL};
+
+    // Every checkpoint must be further into the output than the one before
+    if (span == 0)
+    {
+        span = 1;
+    }
+
+    size_t position = 0;
+    int valid = 0;
+
+    // Members are simply concatenated, and each one starts a new stream
+    do
+    {
+        size_t header = gzip_header_length(bytes + position, length - position);
+
+        if (header == 0)
+        {
+            printf("Invalid gzip header\n");
+            break;
+        }
+
+        struct inflate_state* state = inflate_init();
+
+        if (state == NULL)
+        {
+            break;
+        }
+
+        inflate_set_check(state, INFLATE_CHECK_CRC32);
+        inflate_stop_at_blocks(state, 1);
+
+        position += header;
+
+        uint64_t start_bit = (uint64_t)position * 8;
+        uint64_t start_out = index->total_out;
+        int status;
+
+        do
+        {
+            size_t consumed;
+            size_t produced;
+
+            status = inflate_feed(state, bytes + position, length - position, &consumed, output, INDEX_WINDOW_SIZE, &produced);
+            position += consumed;
+            index->total_out += produced;
+
+            if (status == INFLATE_BLOCK)
+            {
+                uint64_t in_bits;
+                uint64_t out;
+                inflate_position(state, &in_bits, &out);
+
+                if ((index->count == 0 || start_out + out - index->points[index->count - 1].out >= span) &&
+                    add_point(index, state, start_bit + in_bits, start_out + out))
+                {
+                    status = INFLATE_ERROR;
+                }
+            }
+            else if (status == INFLATE_OK && position == length && produced == 0)
+            {
+                printf("Compressed data is truncated\n");
+                status = INFLATE_ERROR;
+            }
+        } while (status == INFLATE_OK || status == INFLATE_BLOCK);
+
+        uint32_t crc = inflate_check_value(state);
+        inflate_end(state);
+
+        if (status != INFLATE_DONE || length - position < 8 ||
+            read_u32(bytes + position) != crc || read_u32(bytes + position + 4) != (uint32_t)(index->total_out - start_out))
+        {
+            printf("gzip member is corrupt\n");
+            break;
+        }
+
+        position += 8;
+        valid = position == length;
+    } while (position < length);
+
+    free(output);
+
+    if (!valid)
+    {
+        gzip_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+// Total length of the decompressed data covered by an index
+uint64_t gzip_index_size(const struct gzip_index* index)
+{
+    return index->total_out;
+}
+
+// Write out a value as little endian bytes
+static int write_value(FILE* file, uint64_t value, size_t size)
+{
+    uint8_t bytes[8];
+
+    for (size_t i = 0; i < size; i++)
+    {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+
+    return fwrite(bytes, 1, size, file) == size ? 0 : -1;
+}
+
+// Read in a little endian value
+static int read_value(FILE* file, uint64_t* value, size_t size)
+{
+    uint8_t bytes[8];
+
+    if (fread(bytes, 1, size, file) != size)
+    {
+        return -1;
+    }
+
+    *value = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        *value |= (uint64_t)bytes[i] << (8 * i);
+    }
+
+    return 0;
+}
+
+// Save an index to a sidecar file, returns 0 on success and -1 on failure
+int gzip_index_save(const struct gzip_index* index, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    int result = fwrite(INDEX_MAGIC, 1, 4, file) == 4 ? 0 : -1;
+    result |= write_value(file, INDEX_VERSION, 4);
+    result |= write_value(file, index->compressed_length, 8);
+    result |= write_value(file, index->trailer, 8);
+    result |= write_value(file, index->total_out, 8);
+    result |= write_value(file, index->count, 4);
+
+    for (size_t i = 0; i < index->count && result == 0; i++)
+    {
+        const struct gzip_index_point* point = &index->points[i];
+
+        result |= write_value(file, point->in_bit, 8);
+        result |= write_value(file, point->out, 8);
+        result |= write_value(file, point->window_length, 4);
+
+        if (fwrite(point->window, 1, point->window_length, file) != point->window_length)
+        {
+            result = -1;
+        }
+    }
+
+    if (fclose(file))
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+// Load an index for the gzip data held in memory from a sidecar file. The
+// length and last 8 bytes of the data are compared against those the index
+// was built from, to catch a stale index. Returns a null pointer if the file
+// is missing, invalid or stale.
+struct gzip_index* gzip_index_load(const char* filename, const void* data, size_t compressed_length)
+{
+    FILE* file = fopen(filename, "rb");
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    struct gzip_index* index = zip_malloc(sizeof(struct gzip_index));
+
+    if (index == NULL)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    *index = (struct gzip_index){.compressed_length = 0, .trailer = 0, .total_out = 0, .count = 0, .capacity = 0, .points = NULL};
+
+    char magic[4];
+    uint64_t version;
+    uint64_t count;
+
+    int valid = fread(magic, 1, 4, file) == 4 && memcmp(magic, INDEX_MAGIC, 4) == 0 &&
+                read_value(file, &version, 4) == 0 && version == INDEX_VERSION &&
+                read_value(file, &index->compressed_length, 8) == 0 && index->compressed_length == compressed_length &&
+                read_value(file, &index->trailer, 8) == 0 && index->trailer == read_trailer(data, compressed_length) &&
+                read_value(file, &index->total_out, 8) == 0 &&
+                read_value(file, &count, 4) == 0 && count > 0;
+
+    if (valid)
+    {
+        index->points = zip_malloc(count * sizeof(struct gzip_index_point));
+        index->capacity = count;
+        valid = index->points != NULL;
+    }
+
+    // The first checkpoint is at the start of the first member's data, and
+    // each one after it is further into both the input and the output, which
+    // the reader relies on to find the one to start from
+    uint64_t first_bit = (uint64_t)gzip_header_length(data, compressed_length) * 8;
+
+    while (valid && index->count < count)
+    {
+        struct gzip_index_point* point = &index->points[index->count];
+        const struct gzip_index_point* last = index->count > 0 ? point - 1 : NULL;
+        uint64_t window_length;
+
+        valid = read_value(file, &point->in_bit, 8) == 0 && read_value(file, &point->out, 8) == 0 &&
+                read_value(file, &window_length, 4) == 0 && window_length <= INDEX_WINDOW_SIZE &&
+                point->in_bit < (uint64_t)compressed_length * 8 && point->out <= index->total_out &&
+                (last == NULL ? point->in_bit == first_bit && first_bit != 0 && point->out == 0 : point->in_bit > last->in_bit && point->out > last->out) &&
+                (point->window = zip_malloc(INDEX_WINDOW_SIZE)) != NULL;
+
+        if (valid)
+        {
+            index->count++;
+            point->window_length = window_length;
+            valid = fread(point->window, 1, window_length, file) == window_length;
+        }
+    }
+
+    fclose(file);
+
+    if (!valid)
+    {
+        gzip_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+// Free an index
+void gzip_index_free(struct gzip_index* index)
+{
+    for (size_t i = 0; i < index->count; i++)
+    {
+        free(index->points[i].window);
+    }
+
+    free(index->points);
+    free(index);
+}
+
+// Start reading the decompressed data at the given offset, resuming from the
+// last checkpoint before it. The data must be the same gzip data the index was
+// built from, and must stay valid until the reader is ended. Returns a null
+// pointer if the allocation fails.
+struct gzip_reader* gzip_reader_open(const struct gzip_index* index, const void* data, size_t length, uint64_t offset)
+{
+    // Find the last checkpoint at or before the offset, the first checkpoint
+    // is always at the start of the data
+    size_t low = 0;
+    size_t high = index->count;
+
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+
+        if (index->points[middle].out <= offset)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    const struct gzip_index_point* point = &index->points[low];
+
+    struct gzip_reader* reader = zip_malloc(sizeof(struct gzip_reader));
+
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+
+    reader->state = inflate_init();
+
+    if (reader->state == NULL)
+    {
+        free(reader);
+        return NULL;
+    }
+
+    reader->data = data;
+    reader->length = length;
+    reader->position = point->in_bit / 8;
+    reader->skip = offset - point->out;
+    reader->done = reader->position >= length;
+
+    // The block can start part way through a byte, in which case the rest of
+    // that byte is loaded directly
+    size_t bits = point->in_bit % 8;
+
+    if (bits != 0 && !reader->done)
+    {
+        inflate_resume(reader->state, point->window, point->window_length, reader->data[reader->position++] >> bits, 8 - bits);
+    }
+    else
+    {
+        inflate_resume(reader->state, point->window, point->window_length, 0, 0);
+    }
+
+    return reader;
+}
+
+// Read up to length bytes of the decompressed data into the buffer, the number
+// of bytes read is stored in produced, which is only less than length at the
+// end of the data. Returns 0 on success and -1 if the data is corrupt.
+int gzip_reader_read(struct gzip_reader* reader, void* buffer, size_t length, size_t* produced)
+{
+    *produced = 0;
+
+    while (*produced < length && !reader->done)
+    {
+        // Output before the offset is decompressed into the buffer and then
+        // thrown away
+        size_t count = length - *produced;
+        uint8_t* dest = (uint8_t*)buffer + *produced;
+
+        if (reader->skip > 0)
+        {
+            count = reader->skip < length ? reader->skip : length;
+            dest = buffer;
+        }
+
+        size_t consumed;
+        size_t written;
+
+        int status = inflate_feed(reader->state, reader->data + reader->position, reader->length - reader->position, &consumed, dest, count, &written);
+        reader->position += consumed;
+
+        if (reader->skip > 0)
+        {
+            reader->skip -= written;
+        }
+        else
+        {
+            *produced += written;
+        }
+
+        if (status == INFLATE_ERROR)
+        {
+            return -1;
+        }
+        else if (status == INFLATE_DONE)
+        {
+            // Skip the trailer, and continue with the next member if there is
+            // one
+            reader->position += 8;
+
+            size_t header = reader->position < reader->length ? gzip_header_length(reader->data + reader->position, reader->length - reader->position) : 0;
+
+            if (header == 0)
+            {
+                reader->done = 1;
+                break;
+            }
+
+            inflate_end(reader->state);
+            reader->state = inflate_init();
+
+            if (reader->state == NULL)
+            {
+                reader->done = 1;
+                return -1;
+            }
+
+            reader->position += header;
+        }
+        else if (reader->position == reader->length && written == 0)
+        {
+            printf("Compressed data is truncated\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Free a reader
+void gzip_reader_end(struct gzip_reader* reader)
+{
+    if (reader->state != NULL)
+    {
+        inflate_end(reader->state);
+    }
+
+    free(reader);
+}
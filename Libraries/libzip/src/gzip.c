@@ -0,0 +1,234 @@
+#include "libzip.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "buf.h"
+
+// Operating system field of the header, 3 is Unix
+#define GZIP_OS_UNIX 3
+
+// Extra flags of the header, which describe the compression level used
+#define XFL_BEST 2
+#define XFL_FASTEST 4
+
+struct gzip_writer
+{
+    struct deflate_state* deflate;
+
+    // Running crc and size of the uncompressed data
+    uint32_t crc;
+    uint32_t size;
+
+    // Output produced by the current call, starting with the header
+    struct exp_buffer out;
+    uint8_t header_pending;
+};
+
+// Read a little endian 32 bit value
+static uint32_t read_u32(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Append a little endian 32 bit value to a buffer
+static void append_u32(struct exp_buffer* buf, uint32_t value)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        append_byte_to_buffer(buf, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+// Allocate the state for writing a new gzip member, compressed at the given
+// level. The name (which may be a null pointer) and modification time are
+// stored in the header. Returns a null pointer if the allocation fails.
+struct gzip_writer* gzip_writer_init(int level, const char* name, uint32_t mtime)
+{
+    struct gzip_writer* writer = zip_malloc(sizeof(struct gzip_writer));
+
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+
+    writer->deflate = deflate_init(level);
+
+    if (writer->deflate == NULL)
+    {
+        free(writer);
+        return NULL;
+    }
+
+    writer->crc = 0;
+    writer->size = 0;
+    writer->out = new_exp_buffer(4096);
+    writer->header_pending = 1;
+
+    if (writer->out.buf == NULL)
+    {
+        deflate_end(writer->deflate);
+        free(writer);
+        return NULL;
+    }
+
+    // Write out the header, which is returned with the first output
+    append_byte_to_buffer(&writer->out, GZIP_MAGIC0);
+    append_byte_to_buffer(&writer->out, GZIP_MAGIC1);
+    append_byte_to_buffer(&writer->out, CM_DEFLATE);
+    append_byte_to_buffer(&writer->out, name != NULL ? FNAME : 0);
+    append_u32(&writer->out, mtime);
+    append_byte_to_buffer(&writer->out, level == DEFLATE_LEVEL_BEST ? XFL_BEST : (level == DEFLATE_LEVEL_FASTEST ? XFL_FASTEST : 0));
+    append_byte_to_buffer(&writer->out, GZIP_OS_UNIX);
+
+    if (name != NULL)
+    {
+        do
+        {
+            append_byte_to_buffer(&writer->out, *name);
+        } while (*name++);
+    }
+
+    return writer;
+}
+
+// Compress the input, which is always consumed completely. Once final is set
+// the trailer is written and no more input can be given. A pointer to the
+// bytes of the member produced by this call is stored in output, which stays
+// valid until the next call. Returns 0 on success and -1 on failure.
+int gzip_writer_feed(struct gzip_writer* writer, const void* input, size_t in_length, int final, const uint8_t** output, size_t* out_length)
+{
+    if (!writer->header_pending)
+    {
+        writer->out.index = 0;
+    }
+
+    writer->header_pending = 0;
+
+    const uint8_t* compressed;
+    size_t compressed_length;
+
+    if (deflate_feed(writer->deflate, input, in_length, final, &compressed, &compressed_length))
+    {
+        return -1;
+    }
+
+    writer->crc = crc32_update(writer->crc, input, in_length);
+    writer->size += in_length;
+
+    if (reserve_buffer(&writer->out, compressed_length + 8))
+    {
+        return -1;
+    }
+
+    memcpy(writer->out.buf + writer->out.index, compressed, compressed_length);
+    writer->out.index += compressed_length;
+
+    if (final)
+    {
+        append_u32(&writer->out, writer->crc);
+        append_u32(&writer->out, writer->size);
+    }
+
+    *output = writer->out.buf;
+    *out_length = writer->out.index;
+
+    return 0;
+}
+
+// Free the state of a gzip member writer
+void gzip_writer_end(struct gzip_writer* writer)
+{
+    deflate_end(writer->deflate);
+    free(writer->out.buf);
+    free(writer);
+}
+
+// Find the length of the gzip header at the start of the data, returns 0 if
+// the header is invalid or incomplete
+size_t gzip_header_length(const void* data, size_t length)
+{
+    const uint8_t* bytes = data;
+
+    if (length < 10 || bytes[0] != GZIP_MAGIC0 || bytes[1] != GZIP_MAGIC1 || bytes[2] != CM_DEFLATE)
+    {
+        return 0;
+    }
+
+    uint8_t flags = bytes[3];
+    size_t offset = 10;
+
+    if (flags & FEXTRA)
+    {
+        if (offset + 2 > length)
+        {
+            return 0;
+        }
+
+        offset += 2 + (bytes[offset] | (bytes[offset + 1] << 8));
+    }
+
+    // Skip the name and comment, which are both null terminated
+    for (uint8_t field = FNAME; field <= FCOMMENT; field <<= 1)
+    {
+        if (flags & field)
+        {
+            while (offset < length && bytes[offset] != 0)
+            {
+                offset++;
+            }
+
+            offset++;
+        }
+    }
+
+    if (flags & FHCRC)
+    {
+        offset += 2;
+    }
+
+    return offset <= length ? offset : 0;
+}
+
+// Decompress a gzip file held in memory which contains a single member. The
+// output is allocated once, using the size stored in the trailer, and the crc
+// is checked if verify is set. This will return a buffer which needs to be
+// free()ed at a later point to avoid a memory leak, this function will return
+// a null pointer if the decompression fails.
+uint8_t* gzip_decompress(const void* data, size_t length, size_t* out_length, int verify)
+{
+    const uint8_t* bytes = data;
+    size_t header = gzip_header_length(data, length);
+
+    if (header == 0 || length < header + 8)
+    {
+        printf("Invalid gzip header\n");
+        return NULL;
+    }
+
+    uint32_t crc = read_u32(bytes + length - 8);
+    size_t size = read_u32(bytes + length - 4);
+    size_t in_length = length - header - 8;
+
+    if (size > in_length * MAX_DEFLATE_RATIO)
+    {
+        size = in_length * MAX_DEFLATE_RATIO;
+    }
+
+    uint8_t* result = deflate_decompress_sized(bytes + header, in_length, size, out_length);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    if ((uint32_t)*out_length != read_u32(bytes + length - 4) || (verify && crc32_update(0, result, *out_length) != crc))
+    {
+        printf("gzip trailer does not match the data\n");
+        free(result);
+        return NULL;
+    }
+
+    return result;
+}
@@ -1,5 +1,6 @@
 #include "huffman.h"
 
+#include <libc/assert.h>
 #include <libc/stdio.h>
 #include <libc/stdlib.h>
 
@@ -124,9 +125,16 @@ struct huffman_node* huffman_from_bit_lengths(uint8_t* bit_lengths, uint16_t* al
         }
     }
 
+    // DEFLATE codes are at most 15 bits long, so the scratch arrays below can
+    // live on the stack
+    if (max_bits > 15)
+    {
+        return NULL;
+    }
+
     // bl_count = [sum(1 for x in bl if x == y and y != 0) for y in range(MAX_BITS+1)]
 
-    size_t* bl_count = malloc((max_bits + 1) * sizeof(size_t));
+    size_t bl_count[16];
 
     for (size_t i = 0; i < (max_bits + 1); i++)
     {
@@ -143,14 +151,7 @@ struct huffman_node* huffman_from_bit_lengths(uint8_t* bit_lengths, uint16_t* al
 
     // next_code = [0, 0]
 
-    size_t next_code_size = 2;
-
-    if (max_bits + 1 > 2)
-    {
-        next_code_size = max_bits + 1;
-    }
-
-    uint16_t* next_code = malloc(next_code_size * sizeof(uint16_t));
+    uint16_t next_code[16];
 
     next_code[0] = 0;
     next_code[1] = 0;
@@ -181,9 +182,207 @@ struct huffman_node* huffman_from_bit_lengths(uint8_t* bit_lengths, uint16_t* al
         }
     }
 
-    free(bl_count);
-    free(next_code);
-    
     // return t
     return t;
-}
\ No newline at end of file
+}
+
+// Reverse the lowest `bits` bits of a code, DEFLATE stores huffman codes
+// starting with the most significant bit, but the bitstream is read starting
+// with the least significant bit
+static uint16_t reverse_code(uint16_t code, uint8_t bits)
+{
+    uint16_t result = 0;
+
+    for (uint8_t i = 0; i < bits; i++)
+    {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+
+    return result;
+}
+
+// Build a two level lookup table for the canonical huffman code described by
+// bit_lengths, symbol i is given the length bit_lengths[i]. The primary table
+// is indexed by the next root_bits bits of the stream, longer codes are
+// resolved through a sub-table. The entries are written to entries, which must
+// have room for the capacity of the table, and the table is pointed at them.
+// Returns 0 on success, and -1 if the lengths do not describe a usable code or
+// the table would not fit within the capacity
+int32_t huffman_table_from_bit_lengths(struct huffman_table* table, struct huffman_entry* entries, const uint8_t* bit_lengths, size_t n, uint8_t root_bits)
+{
+    uint16_t bl_count[16] = {0};
+    uint16_t next_code[16] = {0};
+    uint16_t codes[320];
+
+    assert(n <= 320);
+
+    uint8_t max_bits = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bit_lengths[i] > 15)
+        {
+            return -1;
+        }
+
+        bl_count[bit_lengths[i]]++;
+        max_bits = MAX(max_bits, bit_lengths[i]);
+    }
+
+    bl_count[0] = 0;
+
+    // Reject over-subscribed codes, and incomplete codes other than the
+    // degenerate single code case which DEFLATE allows for distances
+    int32_t left = 1;
+    for (size_t bits = 1; bits < 16; bits++)
+    {
+        left = (left << 1) - bl_count[bits];
+
+        if (left < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (left > 0 && max_bits > 1)
+    {
+        return -1;
+    }
+
+    // Assign the canonical codes
+    for (size_t bits = 2; bits < 16; bits++)
+    {
+        next_code[bits] = (next_code[bits - 1] + bl_count[bits - 1]) << 1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bit_lengths[i] != 0)
+        {
+            codes[i] = reverse_code(next_code[bit_lengths[i]]++, bit_lengths[i]);
+        }
+    }
+
+    // Shrink the primary table for short codes, which is always the case for
+    // the code length code
+    uint8_t root = root_bits;
+
+    if (max_bits < root)
+    {
+        root = max_bits == 0 ? 1 : max_bits;
+    }
+
+    size_t root_size = (size_t)1 << root;
+
+    if (root_size > table->capacity)
+    {
+        return -1;
+    }
+
+    table->entries = entries;
+    table->bits = root;
+
+    struct huffman_entry invalid = (struct huffman_entry){.value = 0, .bits = 1, .op = HUFFMAN_OP_INVALID};
+
+    for (size_t i = 0; i < root_size; i++)
+    {
+        entries[i] = invalid;
+    }
+
+    // Find how wide the sub-table behind every primary entry has to be
+    uint8_t sub_bits[1 << 9] = {0};
+
+    assert(root <= 9);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bit_lengths[i] > root)
+        {
+            size_t prefix = codes[i] & (root_size - 1);
+            sub_bits[prefix] = MAX(sub_bits[prefix], bit_lengths[i] - root);
+        }
+    }
+
+    // Lay the sub-tables out after the primary table
+    size_t used = root_size;
+
+    for (size_t prefix = 0; prefix < root_size; prefix++)
+    {
+        if (sub_bits[prefix] == 0)
+        {
+            continue;
+        }
+
+        size_t size = (size_t)1 << sub_bits[prefix];
+
+        if (used + size > table->capacity)
+        {
+            return -1;
+        }
+
+        entries[prefix] = (struct huffman_entry){.value = used, .bits = root, .op = sub_bits[prefix]};
+
+        for (size_t i = 0; i < size; i++)
+        {
+            entries[used + i] = invalid;
+        }
+
+        used += size;
+    }
+
+    // Fill in every entry whose index begins with each code
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t bitlen = bit_lengths[i];
+
+        if (bitlen == 0)
+        {
+            continue;
+        }
+
+        if (bitlen <= root)
+        {
+            for (size_t j = codes[i]; j < root_size; j += (size_t)1 << bitlen)
+            {
+                entries[j] = (struct huffman_entry){.value = i, .bits = bitlen, .op = HUFFMAN_OP_SYMBOL};
+            }
+        }
+        else
+        {
+            struct huffman_entry link = entries[codes[i] & (root_size - 1)];
+            size_t sub_size = (size_t)1 << link.op;
+
+            for (size_t j = codes[i] >> root; j < sub_size; j += (size_t)1 << (bitlen - root))
+            {
+                entries[link.value + j] = (struct huffman_entry){.value = i, .bits = bitlen - root, .op = HUFFMAN_OP_SYMBOL};
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Decode a single symbol using a lookup table, returns 0 on success and 1 if
+// the stream contains a code which is not part of the table
+uint8_t huffman_decode_table(const struct huffman_table* table, struct bitstream* stream, uint16_t* value)
+{
+    struct huffman_entry entry = table->entries[peek_bits(stream, table->bits)];
+
+    if (entry.op != HUFFMAN_OP_SYMBOL && entry.op != HUFFMAN_OP_INVALID)
+    {
+        consume_bits(stream, entry.bits);
+        entry = table->entries[entry.value + peek_bits(stream, entry.op)];
+    }
+
+    if (entry.op == HUFFMAN_OP_INVALID)
+    {
+        printf("Got to a bad symbol, unable to continue decoding!\n");
+        return 1;
+    }
+
+    consume_bits(stream, entry.bits);
+    *value = entry.value;
+
+    return 0;
+}
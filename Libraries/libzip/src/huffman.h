@@ -6,6 +6,38 @@
 
 #include "bitstream.h"
 
+// Number of bits resolved by a single probe of the primary lookup tables
+#define HUFFMAN_LIT_LEN_ROOT 9
+#define HUFFMAN_DIST_ROOT 6
+#define HUFFMAN_CODE_LEN_ROOT 7
+
+// Upper bounds on the number of entries (primary table plus sub-tables) any
+// valid code can need with the root sizes above, these match the bounds
+// derived for zlib's inflate_table
+#define HUFFMAN_LIT_LEN_ENTRIES 852
+#define HUFFMAN_DIST_ENTRIES 592
+#define HUFFMAN_CODE_LEN_ENTRIES 128
+
+#define HUFFMAN_OP_SYMBOL 0x00
+#define HUFFMAN_OP_INVALID 0xFF
+
+// A single lookup table entry, if op is neither HUFFMAN_OP_SYMBOL nor
+// HUFFMAN_OP_INVALID, the entry links to a sub-table starting at value which
+// is indexed by the next op bits of the stream
+struct huffman_entry
+{
+    uint16_t value;
+    uint8_t bits;
+    uint8_t op;
+};
+
+struct huffman_table
+{
+    const struct huffman_entry* entries;
+    size_t capacity;
+    uint8_t bits;
+};
+
 struct huffman_node
 {
     struct huffman_node* left;
@@ -22,4 +54,7 @@ uint8_t huffman_decode(struct huffman_node* ptr, struct bitstream* stream, uint1
 
 struct huffman_node* huffman_from_bit_lengths(uint8_t* bit_lengths, uint16_t* alphabet, size_t n);
 
+int32_t huffman_table_from_bit_lengths(struct huffman_table* table, struct huffman_entry* entries, const uint8_t* bit_lengths, size_t n, uint8_t root_bits);
+uint8_t huffman_decode_table(const struct huffman_table* table, struct bitstream* stream, uint16_t* value);
+
 #endif // HUFFMAN_H
\ No newline at end of file
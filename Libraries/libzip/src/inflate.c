@@ -0,0 +1,743 @@
+#include "libzip.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "bitstream.h"
+#include "buf.h"
+#include "deflate.h"
+#include "huffman.h"
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Points at which decompression can stop and wait for more input or output
+// space
+enum inflate_mode
+{
+    MODE_HEADER,
+    MODE_STORED_LENGTHS,
+    MODE_STORED_COPY,
+    MODE_TABLE_SIZES,
+    MODE_CODE_LENGTH_LENGTHS,
+    MODE_CODE_LENGTHS,
+    MODE_SYMBOL,
+    MODE_DISTANCE,
+    MODE_COPY,
+    MODE_DONE,
+    MODE_ERROR
+};
+
+// Result of a single step of the state machine
+enum inflate_step
+{
+    STEP_CONTINUE,
+    STEP_SUSPEND
+};
+
+struct inflate_state
+{
+    enum inflate_mode mode;
+    uint8_t final;
+
+    // Bits loaded by previous calls which have not been consumed yet
+    uint64_t bit_buffer;
+    size_t bit_count;
+
+    // Bytes left in the current stored block or match
+    size_t remaining;
+    size_t distance;
+
+    // Dynamic block header
+    size_t hlit;
+    size_t hdist;
+    size_t hclen;
+    size_t index;
+    uint8_t code_length_lengths[19];
+    uint8_t lengths[286 + 30];
+
+    // Tables used by the current block
+    const struct huffman_table* lit_len;
+    const struct huffman_table* dist;
+
+    struct huffman_table code_length_table;
+    struct huffman_table lit_len_table;
+    struct huffman_table dist_table;
+
+    struct huffman_entry code_length_entries[HUFFMAN_CODE_LEN_ENTRIES];
+    struct huffman_entry lit_len_entries[HUFFMAN_LIT_LEN_ENTRIES];
+    struct huffman_entry dist_entries[HUFFMAN_DIST_ENTRIES];
+
+    // Totals over the whole stream
+    size_t total_in;
+    size_t total_out;
+
+    // Checksum kept over the output, if any
+    int check;
+    uint32_t check_value;
+
+    // Set when inflate_feed should return at every block boundary, and while
+    // the boundary about to be decoded has already been reported
+    uint8_t stop_at_blocks;
+    uint8_t block_reported;
+    uint8_t at_block;
+
+    // The most recent 32 KiB of output, which matches can refer back into
+    uint8_t window[WINDOW_SIZE];
+};
+
+// Output chunk given to inflate_feed
+struct inflate_output
+{
+    uint8_t* ptr;
+    size_t length;
+    size_t written;
+};
+
+// Allocate the state for a new incremental decompression, returns a null
+// pointer if the allocation fails
+struct inflate_state* inflate_init()
+{
+    struct inflate_state* state = zip_malloc(sizeof(struct inflate_state));
+
+    if (state == NULL)
+    {
+        return NULL;
+    }
+
+    state->mode = MODE_HEADER;
+    state->final = 0;
+    state->bit_buffer = 0;
+    state->bit_count = 0;
+    state->remaining = 0;
+    state->distance = 0;
+    state->total_in = 0;
+    state->total_out = 0;
+    state->check = INFLATE_CHECK_NONE;
+    state->check_value = 0;
+    state->stop_at_blocks = 0;
+    state->block_reported = 0;
+    state->at_block = 0;
+
+    state->code_length_table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_CODE_LEN_ENTRIES, .bits = 0};
+    state->lit_len_table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_LIT_LEN_ENTRIES, .bits = 0};
+    state->dist_table = (struct huffman_table){.entries = NULL, .capacity = HUFFMAN_DIST_ENTRIES, .bits = 0};
+
+    return state;
+}
+
+// Keep a checksum of the decompressed data, computed over each chunk of output
+// as it is produced. This must be set before the first call to inflate_feed.
+void inflate_set_check(struct inflate_state* state, int check)
+{
+    state->check = check;
+    state->check_value = check == INFLATE_CHECK_ADLER32 ? 1 : 0;
+}
+
+// Checksum of all of the output so far, as selected by inflate_set_check
+uint32_t inflate_check_value(const struct inflate_state* state)
+{
+    return state->check_value;
+}
+
+// Make inflate_feed return INFLATE_BLOCK whenever it reaches the start of a
+// block, which are the only points decompression can later be resumed from
+void inflate_stop_at_blocks(struct inflate_state* state, int stop)
+{
+    state->stop_at_blocks = stop != 0;
+}
+
+// Position of the decompression, as the number of bits of input consumed and
+// the number of bytes of output produced
+void inflate_position(const struct inflate_state* state, uint64_t* in_bits, uint64_t* out_bytes)
+{
+    *in_bits = (uint64_t)state->total_in * 8 - state->bit_count;
+    *out_bytes = state->total_out;
+}
+
+// Copy the most recent output (at most 32 KiB of it), which later matches can
+// refer back into, to dest in order. Returns the number of bytes copied.
+size_t inflate_window(const struct inflate_state* state, uint8_t* dest)
+{
+    size_t length = MIN(state->total_out, WINDOW_SIZE);
+    size_t start = (state->total_out - length) & WINDOW_MASK;
+    size_t first = MIN(length, WINDOW_SIZE - start);
+
+    memcpy(dest, state->window + start, first);
+    memcpy(dest + first, state->window, length - first);
+
+    return length;
+}
+
+// Start a new decompression part way through a stream, at the start of a
+// block. The window is the output preceding that point (as returned by
+// inflate_window), and the count (less than 8) bits of value are the part of
+// the block which share a byte with the end of the previous one. This must be
+// called before the first call to inflate_feed.
+void inflate_resume(struct inflate_state* state, const uint8_t* window, size_t length, uint32_t value, size_t count)
+{
+    length = MIN(length, WINDOW_SIZE);
+
+    memcpy(state->window, window, length);
+    state->total_out = length;
+
+    state->bit_buffer = value & ((1 << count) - 1);
+    state->bit_count = count;
+}
+
+// Free the state of an incremental decompression
+void inflate_end(struct inflate_state* state)
+{
+    free(state);
+}
+
+// Make sure at least count bits are available, returns 0 if the input ran out
+static uint8_t ensure_bits(struct bitstream* s, size_t count)
+{
+    if (s->count < count)
+    {
+        bitstream_refill(s);
+    }
+
+    return s->count >= count;
+}
+
+// Look up the next symbol without consuming it, returns 0 on success, 1 if
+// more input is needed to finish the code and -1 if the code is invalid
+static int peek_symbol(struct bitstream* s, const struct huffman_table* table, uint16_t* symbol, size_t* bits)
+{
+    struct huffman_entry entry = table->entries[peek_bits(s, table->bits)];
+    size_t used = 0;
+
+    if (entry.op != HUFFMAN_OP_SYMBOL && entry.op != HUFFMAN_OP_INVALID)
+    {
+        used = entry.bits;
+        entry = table->entries[entry.value + (peek_bits(s, used + entry.op) >> used)];
+    }
+
+    if (entry.op == HUFFMAN_OP_INVALID)
+    {
+        // Missing input reads as zeros, so only trust this once enough bits
+        // have actually arrived
+        return s->count < used + table->bits ? 1 : -1;
+    }
+
+    if (used + entry.bits > s->count)
+    {
+        return 1;
+    }
+
+    *symbol = entry.value;
+    *bits = used + entry.bits;
+
+    return 0;
+}
+
+// Copy bytes into the sliding window
+static void window_append(struct inflate_state* state, const uint8_t* data, size_t length)
+{
+    if (length > WINDOW_SIZE)
+    {
+        state->total_out += length - WINDOW_SIZE;
+        data += length - WINDOW_SIZE;
+        length = WINDOW_SIZE;
+    }
+
+    size_t position = state->total_out & WINDOW_MASK;
+    size_t first = MIN(length, WINDOW_SIZE - position);
+
+    memcpy(state->window + position, data, first);
+    memcpy(state->window, data + first, length - first);
+
+    state->total_out += length;
+}
+
+// Write a single byte of output
+static inline void put_byte(struct inflate_state* state, struct inflate_output* out, uint8_t byte)
+{
+    out->ptr[out->written++] = byte;
+    state->window[state->total_out++ & WINDOW_MASK] = byte;
+}
+
+// Move on after the end of a block
+static void next_block(struct inflate_state* state)
+{
+    state->mode = state->final ? MODE_DONE : MODE_HEADER;
+}
+
+// Report a malformed stream
+static enum inflate_step fail(struct inflate_state* state, const char* message)
+{
+    printf("inflate: %s\n", message);
+    state->mode = MODE_ERROR;
+
+    return STEP_SUSPEND;
+}
+
+// Read the three bit header at the start of every block
+static enum inflate_step step_header(struct inflate_state* state, struct bitstream* s)
+{
+    if (!ensure_bits(s, 3))
+    {
+        return STEP_SUSPEND;
+    }
+
+    state->block_reported = 0;
+    state->final = read_bits32(s, 1);
+    enum blocktype block_type = read_bits32(s, 2);
+
+    switch (block_type)
+    {
+        case NOCOMPRESSION:
+            state->mode = MODE_STORED_LENGTHS;
+            break;
+
+        case FIXEDCOMPRESSION:
+            state->lit_len = &default_lit_len_table;
+            state->dist = &default_dist_table;
+            state->mode = MODE_SYMBOL;
+            break;
+
+        case DYNAMICCOMPRESSION:
+            state->mode = MODE_TABLE_SIZES;
+            break;
+
+        default:
+            return fail(state, "unknown block type");
+    }
+
+    return STEP_CONTINUE;
+}
+
+// Read the LEN and NLEN fields of a stored block
+static enum inflate_step step_stored_lengths(struct inflate_state* state, struct bitstream* s)
+{
+    // The lengths start at the next byte boundary
+    consume_bits(s, s->count & 7);
+
+    if (!ensure_bits(s, 32))
+    {
+        return STEP_SUSPEND;
+    }
+
+    uint16_t len = read_bits32(s, 16);
+    uint16_t nlen = read_bits32(s, 16);
+
+    if (len != (uint16_t)~nlen)
+    {
+        return fail(state, "LEN and NLEN do not match");
+    }
+
+    state->remaining = len;
+    state->mode = MODE_STORED_COPY;
+
+    return STEP_CONTINUE;
+}
+
+// Copy the contents of a stored block
+static enum inflate_step step_stored_copy(struct inflate_state* state, struct bitstream* s, struct inflate_output* out)
+{
+    // Drain any whole bytes still held in the accumulator
+    while (state->remaining && out->written < out->length && s->count >= 8)
+    {
+        put_byte(state, out, (uint8_t)read_bits32(s, 8));
+        state->remaining--;
+    }
+
+    if (state->remaining && out->written < out->length)
+    {
+        // Bytes after the ones consumed may have been left in the accumulator
+        // by a word refill
+        s->buffer = 0;
+
+        size_t count = MIN(state->remaining, out->length - out->written);
+        count = MIN(count, s->length - s->byte);
+
+        memcpy(out->ptr + out->written, s->ptr + s->byte, count);
+        window_append(state, s->ptr + s->byte, count);
+
+        s->byte += count;
+        out->written += count;
+        state->remaining -= count;
+    }
+
+    if (state->remaining)
+    {
+        return STEP_SUSPEND;
+    }
+
+    next_block(state);
+
+    return STEP_CONTINUE;
+}
+
+// Read the sizes at the start of a dynamic block header
+static enum inflate_step step_table_sizes(struct inflate_state* state, struct bitstream* s)
+{
+    if (!ensure_bits(s, 14))
+    {
+        return STEP_SUSPEND;
+    }
+
+    state->hlit = read_bits32(s, 5) + 257;
+    state->hdist = read_bits32(s, 5) + 1;
+    state->hclen = read_bits32(s, 4) + 4;
+
+    if (state->hlit > 286 || state->hdist > 30)
+    {
+        return fail(state, "too many length or distance codes");
+    }
+
+    memset(state->code_length_lengths, 0, sizeof(state->code_length_lengths));
+    state->index = 0;
+    state->mode = MODE_CODE_LENGTH_LENGTHS;
+
+    return STEP_CONTINUE;
+}
+
+// Read the code lengths of the code length code
+static enum inflate_step step_code_length_lengths(struct inflate_state* state, struct bitstream* s)
+{
+    while (state->index < state->hclen)
+    {
+        if (!ensure_bits(s, 3))
+        {
+            return STEP_SUSPEND;
+        }
+
+        state->code_length_lengths[CodeLengthCodesOrder[state->index++]] = read_bits32(s, 3);
+    }
+
+    if (huffman_table_from_bit_lengths(&state->code_length_table, state->code_length_entries, state->code_length_lengths, 19, HUFFMAN_CODE_LEN_ROOT))
+    {
+        return fail(state, "bad code length code");
+    }
+
+    state->index = 0;
+    state->mode = MODE_CODE_LENGTHS;
+
+    return STEP_CONTINUE;
+}
+
+// Read the literal/length and distance code lengths
+static enum inflate_step step_code_lengths(struct inflate_state* state, struct bitstream* s)
+{
+    size_t total = state->hlit + state->hdist;
+
+    while (state->index < total)
+    {
+        uint16_t sym;
+        size_t bits;
+        int result = peek_symbol(s, &state->code_length_table, &sym, &bits);
+
+        if (result < 0)
+        {
+            return fail(state, "bad code length symbol");
+        }
+        else if (result > 0)
+        {
+            return STEP_SUSPEND;
+        }
+
+        if (sym <= 15)
+        {
+            consume_bits(s, bits);
+            state->lengths[state->index++] = sym;
+            continue;
+        }
+
+        // Repeats are only consumed once their extra bits have arrived too
+        size_t extra = sym == 16 ? 2 : (sym == 17 ? 3 : 7);
+
+        if (!ensure_bits(s, bits + extra))
+        {
+            return STEP_SUSPEND;
+        }
+
+        consume_bits(s, bits);
+
+        size_t repeat = read_bits32(s, extra) + (sym == 18 ? 11 : 3);
+        uint8_t value = 0;
+
+        if (sym == 16)
+        {
+            if (state->index == 0)
+            {
+                return fail(state, "repeat with no previous code length");
+            }
+
+            value = state->lengths[state->index - 1];
+        }
+
+        if (state->index + repeat > total)
+        {
+            return fail(state, "code length repeat runs past the end");
+        }
+
+        memset(state->lengths + state->index, value, repeat);
+        state->index += repeat;
+    }
+
+    if (huffman_table_from_bit_lengths(&state->lit_len_table, state->lit_len_entries, state->lengths, state->hlit, HUFFMAN_LIT_LEN_ROOT))
+    {
+        return fail(state, "bad literal/length code");
+    }
+
+    if (huffman_table_from_bit_lengths(&state->dist_table, state->dist_entries, state->lengths + state->hlit, state->hdist, HUFFMAN_DIST_ROOT))
+    {
+        return fail(state, "bad distance code");
+    }
+
+    state->lit_len = &state->lit_len_table;
+    state->dist = &state->dist_table;
+    state->mode = MODE_SYMBOL;
+
+    return STEP_CONTINUE;
+}
+
+// Decode literals until a length symbol or the end of the block
+static enum inflate_step step_symbol(struct inflate_state* state, struct bitstream* s, struct inflate_output* out)
+{
+    for (;;)
+    {
+        if (out->written == out->length)
+        {
+            return STEP_SUSPEND;
+        }
+
+        uint16_t sym;
+        size_t bits;
+        int result = peek_symbol(s, state->lit_len, &sym, &bits);
+
+        if (result < 0)
+        {
+            return fail(state, "bad literal/length symbol");
+        }
+        else if (result > 0)
+        {
+            return STEP_SUSPEND;
+        }
+
+        if (sym <= 255)
+        {
+            consume_bits(s, bits);
+            put_byte(state, out, (uint8_t)sym);
+        }
+        else if (sym == 256)
+        {
+            consume_bits(s, bits);
+            next_block(state);
+
+            return STEP_CONTINUE;
+        }
+        else
+        {
+            sym -= 257;
+
+            if (sym >= 29)
+            {
+                return fail(state, "bad length symbol");
+            }
+
+            if (!ensure_bits(s, bits + LengthExtraBits[sym]))
+            {
+                return STEP_SUSPEND;
+            }
+
+            consume_bits(s, bits);
+            state->remaining = read_bits32(s, LengthExtraBits[sym]) + LengthBase[sym];
+            state->mode = MODE_DISTANCE;
+
+            return STEP_CONTINUE;
+        }
+    }
+}
+
+// Decode the distance following a length
+static enum inflate_step step_distance(struct inflate_state* state, struct bitstream* s)
+{
+    uint16_t sym;
+    size_t bits;
+    int result = peek_symbol(s, state->dist, &sym, &bits);
+
+    if (result < 0)
+    {
+        return fail(state, "bad distance symbol");
+    }
+    else if (result > 0)
+    {
+        return STEP_SUSPEND;
+    }
+
+    if (sym >= 30)
+    {
+        return fail(state, "bad distance symbol");
+    }
+
+    if (!ensure_bits(s, bits + DistanceExtraBits[sym]))
+    {
+        return STEP_SUSPEND;
+    }
+
+    consume_bits(s, bits);
+    state->distance = read_bits32(s, DistanceExtraBits[sym]) + DistanceBase[sym];
+
+    if (state->distance > state->total_out)
+    {
+        return fail(state, "distance reaches before the start of the output");
+    }
+
+    state->mode = MODE_COPY;
+
+    return STEP_CONTINUE;
+}
+
+// Copy a match out of the window
+static enum inflate_step step_copy(struct inflate_state* state, struct inflate_output* out)
+{
+    while (state->remaining && out->written < out->length)
+    {
+        size_t from = (state->total_out - state->distance) & WINDOW_MASK;
+        size_t to = state->total_out & WINDOW_MASK;
+
+        // Copy as much as possible at once without either end wrapping around
+        // the window, and without reading bytes this copy has yet to write
+        size_t count = MIN(state->remaining, out->length - out->written);
+        count = MIN(count, WINDOW_SIZE - (from > to ? from : to));
+
+        if (state->distance == 1)
+        {
+            memset(state->window + to, state->window[from], count);
+        }
+        else
+        {
+            count = MIN(count, state->distance);
+            memmove(state->window + to, state->window + from, count);
+        }
+
+        memcpy(out->ptr + out->written, state->window + to, count);
+
+        out->written += count;
+        state->total_out += count;
+        state->remaining -= count;
+    }
+
+    if (state->remaining)
+    {
+        return STEP_SUSPEND;
+    }
+
+    state->mode = MODE_SYMBOL;
+
+    return STEP_CONTINUE;
+}
+
+// Run a single step of the state machine
+static enum inflate_step inflate_step(struct inflate_state* state, struct bitstream* s, struct inflate_output* out)
+{
+    switch (state->mode)
+    {
+        case MODE_HEADER:
+            if (state->stop_at_blocks && !state->block_reported)
+            {
+                state->block_reported = 1;
+                state->at_block = 1;
+                return STEP_SUSPEND;
+            }
+
+            return step_header(state, s);
+        case MODE_STORED_LENGTHS:
+            return step_stored_lengths(state, s);
+        case MODE_STORED_COPY:
+            return step_stored_copy(state, s, out);
+        case MODE_TABLE_SIZES:
+            return step_table_sizes(state, s);
+        case MODE_CODE_LENGTH_LENGTHS:
+            return step_code_length_lengths(state, s);
+        case MODE_CODE_LENGTHS:
+            return step_code_lengths(state, s);
+        case MODE_SYMBOL:
+            return step_symbol(state, s, out);
+        case MODE_DISTANCE:
+            return step_distance(state, s);
+        case MODE_COPY:
+            return step_copy(state, out);
+        default:
+            return STEP_SUSPEND;
+    }
+}
+
+// Decompress as much of the input as possible into the output chunk. The
+// number of input bytes used is stored in consumed, and any bytes which were
+// not consumed must be passed in again on the next call. The number of bytes
+// written is stored in produced. Returns INFLATE_DONE once the final block has
+// been decoded, INFLATE_ERROR if the data is malformed, and INFLATE_OK if
+// either more input or more output space is needed (if produced is equal to
+// out_length, call again with a fresh output chunk before adding input). If
+// enabled by inflate_stop_at_blocks, INFLATE_BLOCK is returned at the start of
+// each block, and the call can simply be repeated with the remaining input.
+int inflate_feed(struct inflate_state* state, const void* input, size_t in_length, size_t* consumed, void* output, size_t out_length, size_t* produced)
+{
+    struct bitstream s;
+    bitstream_init(&s, input, in_length);
+
+    s.buffer = state->bit_buffer;
+    s.count = state->bit_count;
+
+    struct inflate_output out = (struct inflate_output){.ptr = output, .length = out_length, .written = 0};
+
+    while (inflate_step(state, &s, &out) == STEP_CONTINUE);
+
+    if (state->mode == MODE_DONE || out.written == out.length)
+    {
+        // Give back whole bytes which were loaded ahead into the accumulator
+        // during this call, so the caller sees exactly where the compressed
+        // data stops. If the input ran out instead, every bit held is needed
+        // by the step waiting for more input, so they all stay.
+        size_t ahead = MIN(s.count >> 3, s.byte);
+
+        s.byte -= ahead;
+        s.count -= ahead * 8;
+    }
+
+    if (state->mode == MODE_DONE)
+    {
+        s.count = 0;
+    }
+
+    state->bit_buffer = s.count < 64 ? s.buffer & (((uint64_t)1 << s.count) - 1) : s.buffer;
+    state->bit_count = s.count;
+    state->total_in += s.byte;
+
+    *consumed = s.byte;
+    *produced = out.written;
+
+    // The output is still in the cache, so this is the cheapest time to check it
+    if (state->check == INFLATE_CHECK_CRC32)
+    {
+        state->check_value = crc32_update(state->check_value, output, out.written);
+    }
+    else if (state->check == INFLATE_CHECK_ADLER32)
+    {
+        state->check_value = adler32_update(state->check_value, output, out.written);
+    }
+
+    if (state->mode == MODE_DONE)
+    {
+        return INFLATE_DONE;
+    }
+    else if (state->mode == MODE_ERROR)
+    {
+        return INFLATE_ERROR;
+    }
+    else if (state->at_block)
+    {
+        state->at_block = 0;
+        return INFLATE_BLOCK;
+    }
+
+    return INFLATE_OK;
+}
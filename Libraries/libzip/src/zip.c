@@ -0,0 +1,340 @@
+#include "libzip.h"
+
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "buf.h"
+
+/*
+    A PKZIP archive ends with an end of central directory record, which points
+    to the central directory: one record per member giving its name, sizes,
+    crc and the offset of its local header, which is followed by its data.
+    Only the central directory is read when opening an archive, and the names
+    are put in a hash table, so finding and extracting a member never looks at
+    any of the others.
+*/
+
+#define ZIP_LOCAL_SIGNATURE 0x04034b50
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50
+#define ZIP_END_SIGNATURE 0x06054b50
+
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+
+// Largest comment which can follow the end of central directory record
+#define ZIP_MAX_COMMENT 65535
+
+// Members which are encrypted cannot be extracted
+#define ZIP_FLAG_ENCRYPTED 1
+
+// Hash table slots which do not hold an entry
+#define ZIP_EMPTY_SLOT 0xFFFFFFFF
+
+struct zip_archive
+{
+    const uint8_t* data;
+    size_t length;
+
+    size_t count;
+    struct zip_entry* entries;
+
+    // Every name, each null terminated
+    char* names;
+
+    // Open addressed hash table of entry indices, the size is a power of two
+    uint32_t* slots;
+    size_t slot_mask;
+};
+
+// Read a little endian 16 bit value
+static uint16_t read_u16(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8);
+}
+
+// Read a little endian 32 bit value
+static uint32_t read_u32(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// FNV-1a hash of a name
+static uint32_t hash_name(const char* name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Find the end of central directory record, which is followed by a comment of
+// unknown length, returns a null pointer if there is none
+static const uint8_t* find_end_record(const uint8_t* data, size_t length)
+{
+    if (length < ZIP_END_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t lowest = length - ZIP_END_SIZE > ZIP_MAX_COMMENT ? length - ZIP_END_SIZE - ZIP_MAX_COMMENT : 0;
+
+    for (size_t offset = length - ZIP_END_SIZE + 1; offset-- > lowest;)
+    {
+        if (read_u32(data + offset) == ZIP_END_SIGNATURE && offset + ZIP_END_SIZE + read_u16(data + offset + 20) == length)
+        {
+            return data + offset;
+        }
+    }
+
+    return NULL;
+}
+
+// Open a zip archive held in memory (which must stay valid until the archive
+// is closed) by reading its central directory. Returns a null pointer if the
+// archive is invalid or an allocation fails.
+struct zip_archive* zip_open(const void* data, size_t length)
+{
+    const uint8_t* end = find_end_record(data, length);
+
+    if (end == NULL)
+    {
+        printf("Not a zip archive\n");
+        return NULL;
+    }
+
+    size_t count = read_u16(end + 10);
+    size_t directory_size = read_u32(end + 12);
+    size_t directory_offset = read_u32(end + 16);
+
+    // Archives which need the zip64 extensions are not supported
+    if (read_u16(end + 4) != 0 || read_u16(end + 6) != 0 || count == 0xFFFF || directory_offset == 0xFFFFFFFF)
+    {
+        printf("Multi-disk and zip64 archives are not supported\n");
+        return NULL;
+    }
+
+    if (directory_offset > (size_t)(end - (const uint8_t*)data) || directory_size > (size_t)(end - (const uint8_t*)data) - directory_offset)
+    {
+        printf("Central directory is out of bounds\n");
+        return NULL;
+    }
+
+    struct zip_archive* archive = zip_malloc(sizeof(struct zip_archive));
+
+    if (archive == NULL)
+    {
+        return NULL;
+    }
+
+    size_t slots = 16;
+
+    while (slots < count * 2)
+    {
+        slots <<= 1;
+    }
+
+    *archive = (struct zip_archive){.data = data, .length = length, .count = 0, .slot_mask = slots - 1};
+    archive->entries = zip_malloc(count * sizeof(struct zip_entry) + 1);
+    archive->names = zip_malloc(directory_size + 1);
+    archive->slots = zip_malloc(slots * sizeof(uint32_t));
+
+    if (archive->entries == NULL || archive->names == NULL || archive->slots == NULL)
+    {
+        zip_close(archive);
+        return NULL;
+    }
+
+    memset(archive->slots, 0xFF, slots * sizeof(uint32_t));
+
+    const uint8_t* record = (const uint8_t*)data + directory_offset;
+    const uint8_t* directory_end = record + directory_size;
+    char* name = archive->names;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (directory_end - record < ZIP_CENTRAL_SIZE || read_u32(record) != ZIP_CENTRAL_SIGNATURE)
+        {
+            printf("Bad central directory record\n");
+            zip_close(archive);
+            return NULL;
+        }
+
+        size_t name_length = read_u16(record + 28);
+        size_t record_length = ZIP_CENTRAL_SIZE + name_length + read_u16(record + 30) + read_u16(record + 32);
+
+        if ((size_t)(directory_end - record) < record_length)
+        {
+            printf("Bad central directory record\n");
+            zip_close(archive);
+            return NULL;
+        }
+
+        // The names are copied out, so they can be null terminated. They
+        // always fit, as each record is longer than its name.
+        memcpy(name, record + ZIP_CENTRAL_SIZE, name_length);
+        name[name_length] = 0;
+
+        archive->entries[i] = (struct zip_entry){
+            .name = name,
+            .flags = read_u16(record + 8),
+            .method = read_u16(record + 10),
+            .crc = read_u32(record + 16),
+            .compressed_size = read_u32(record + 20),
+            .size = read_u32(record + 24),
+            .offset = read_u32(record + 42)};
+
+        // Later entries with the same name replace earlier ones
+        size_t slot = hash_name(name, name_length) & archive->slot_mask;
+
+        while (archive->slots[slot] != ZIP_EMPTY_SLOT && strcmp(archive->entries[archive->slots[slot]].name, name) != 0)
+        {
+            slot = (slot + 1) & archive->slot_mask;
+        }
+
+        archive->slots[slot] = i;
+        archive->count++;
+
+        name += name_length + 1;
+        record += record_length;
+    }
+
+    return archive;
+}
+
+// Number of members in an archive
+size_t zip_entry_count(const struct zip_archive* archive)
+{
+    return archive->count;
+}
+
+// Get the directory entry of a member by its index
+const struct zip_entry* zip_entry_at(const struct zip_archive* archive, size_t index)
+{
+    return index < archive->count ? &archive->entries[index] : NULL;
+}
+
+// Find a member by its full name within the archive, returns its index or -1
+// if there is no such member
+long zip_find(const struct zip_archive* archive, const char* name)
+{
+    size_t slot = hash_name(name, strlen(name)) & archive->slot_mask;
+
+    while (archive->slots[slot] != ZIP_EMPTY_SLOT)
+    {
+        if (strcmp(archive->entries[archive->slots[slot]].name, name) == 0)
+        {
+            return archive->slots[slot];
+        }
+
+        slot = (slot + 1) & archive->slot_mask;
+    }
+
+    return -1;
+}
+
+// Extract a member, which must be stored or compressed with DEFLATE, checking
+// its crc if verify is set. This will return a buffer which needs to be
+// free()ed at a later point to avoid a memory leak, this function will return
+// a null pointer if the extraction fails.
+uint8_t* zip_extract(const struct zip_archive* archive, size_t index, size_t* length, int verify)
+{
+    if (index >= archive->count)
+    {
+        return NULL;
+    }
+
+    const struct zip_entry* entry = &archive->entries[index];
+
+    if (entry->flags & ZIP_FLAG_ENCRYPTED)
+    {
+        printf("`%s` is encrypted\n", entry->name);
+        return NULL;
+    }
+
+    // The local header repeats the name and has its own extra field, so its
+    // length has to be read to find the data
+    if (entry->offset > archive->length - ZIP_LOCAL_SIZE || archive->length < ZIP_LOCAL_SIZE ||
+        read_u32(archive->data + entry->offset) != ZIP_LOCAL_SIGNATURE)
+    {
+        printf("Bad local header for `%s`\n", entry->name);
+        return NULL;
+    }
+
+    const uint8_t* local = archive->data + entry->offset;
+    size_t start = entry->offset + ZIP_LOCAL_SIZE + read_u16(local + 26) + read_u16(local + 28);
+
+    if (start > archive->length || entry->compressed_size > archive->length - start)
+    {
+        printf("Data for `%s` is out of bounds\n", entry->name);
+        return NULL;
+    }
+
+    const uint8_t* compressed = archive->data + start;
+    uint8_t* result;
+
+    if (entry->method == ZIP_METHOD_STORED)
+    {
+        if (entry->compressed_size != entry->size)
+        {
+            return NULL;
+        }
+
+        // Always allocate at least a byte, so an empty member is not a failure
+        result = zip_malloc(entry->size + 1);
+
+        if (result == NULL)
+        {
+            return NULL;
+        }
+
+        memcpy(result, compressed, entry->size);
+        *length = entry->size;
+    }
+    else if (entry->method == ZIP_METHOD_DEFLATE)
+    {
+        // The size is only used to allocate the output up front, so it is
+        // trusted no further than the compressed data could expand to
+        size_t expected = entry->size;
+
+        if (expected > (uint64_t)entry->compressed_size * MAX_DEFLATE_RATIO)
+        {
+            expected = (size_t)entry->compressed_size * MAX_DEFLATE_RATIO;
+        }
+
+        result = deflate_decompress_sized(compressed, entry->compressed_size, expected, length);
+
+        if (result == NULL)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        printf("`%s` uses unsupported compression method %u\n", entry->name, entry->method);
+        return NULL;
+    }
+
+    if (*length != entry->size || (verify && crc32_update(0, result, *length) != entry->crc))
+    {
+        printf("`%s` is corrupt\n", entry->name);
+        free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+// Free an archive, which does not touch the data it was opened from
+void zip_close(struct zip_archive* archive)
+{
+    free(archive->entries);
+    free(archive->names);
+    free(archive->slots);
+    free(archive);
+}
@@ -0,0 +1,169 @@
+// Host-side generator for the constant tables used by libzip, which prints
+// them as C source so they are built into the library as read only data
+// instead of being computed by every process which uses it
+//
+//     mktables fixed   lookup tables for the fixed huffman codes
+//     mktables crc     slicing-by-8 CRC-32 tables
+
+#include <stdio.h>
+#include <string.h>
+
+#include "huffman.h"
+
+// Print the entries of a lookup table
+static void print_entries(const char* name, const struct huffman_table* table, size_t count)
+{
+    printf("static const struct huffman_entry %s[%zu] =\n{\n", name, count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct huffman_entry* entry = &table->entries[i];
+        printf("    {.value = %u, .bits = %u, .op = %u},\n", entry->value, entry->bits, entry->op);
+    }
+
+    printf("};\n\n");
+}
+
+// Print a lookup table which refers to already printed entries
+static void print_table(const char* name, const char* entries, const struct huffman_table* table, size_t count)
+{
+    printf("const struct huffman_table %s = (struct huffman_table){.entries = %s, .capacity = %zu, .bits = %u};\n",
+        name, entries, count, table->bits);
+}
+
+// Build the lookup tables for the fixed huffman codes
+static int print_fixed_tables()
+{
+    static struct huffman_entry lit_len_entries[1 << HUFFMAN_LIT_LEN_ROOT];
+    static struct huffman_entry dist_entries[1 << HUFFMAN_DIST_ROOT];
+
+    struct huffman_table lit_len_table = (struct huffman_table){.entries = NULL, .capacity = 1 << HUFFMAN_LIT_LEN_ROOT, .bits = 0};
+    struct huffman_table dist_table = (struct huffman_table){.entries = NULL, .capacity = 1 << HUFFMAN_DIST_ROOT, .bits = 0};
+
+    uint8_t bl[288];
+    size_t i = 0;
+
+    for (; i < 144; i++)
+    {
+        bl[i] = 8;
+    }
+
+    for (; i < 256; i++)
+    {
+        bl[i] = 9;
+    }
+
+    for (; i < 280; i++)
+    {
+        bl[i] = 7;
+    }
+
+    for (; i < 288; i++)
+    {
+        bl[i] = 8;
+    }
+
+    // Symbols 286 and 287 (and distances 30 and 31) take part in the fixed
+    // code, but are rejected if they ever appear in the stream
+    if (huffman_table_from_bit_lengths(&lit_len_table, lit_len_entries, bl, 288, HUFFMAN_LIT_LEN_ROOT))
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < 32; i++)
+    {
+        bl[i] = 5;
+    }
+
+    if (huffman_table_from_bit_lengths(&dist_table, dist_entries, bl, 32, HUFFMAN_DIST_ROOT))
+    {
+        return -1;
+    }
+
+    // None of the fixed codes are longer than the primary tables, so only the
+    // primary entries are used
+    size_t lit_len_count = (size_t)1 << lit_len_table.bits;
+    size_t dist_count = (size_t)1 << dist_table.bits;
+
+    printf("// Generated by tools/mktables.c, do not edit\n\n");
+    print_entries("default_lit_len_entries", &lit_len_table, lit_len_count);
+    print_entries("default_dist_entries", &dist_table, dist_count);
+    print_table("default_lit_len_table", "default_lit_len_entries", &lit_len_table, lit_len_count);
+    print_table("default_dist_table", "default_dist_entries", &dist_table, dist_count);
+
+    return 0;
+}
+
+// Build the crc tables, for the reflected polynomial 0xEDB88320.
+// crc_tables[k][n] is the crc of the byte n followed by k zero bytes.
+static int print_crc_tables()
+{
+    static uint32_t tables[8][256];
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+
+        for (size_t k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+
+        tables[0][n] = c;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        for (size_t k = 1; k < 8; k++)
+        {
+            uint32_t c = tables[k - 1][n];
+            tables[k][n] = tables[0][c & 0xFF] ^ (c >> 8);
+        }
+    }
+
+    printf("// Generated by tools/mktables.c, do not edit\n\n");
+    printf("static const uint32_t crc_tables[8][256] =\n{\n");
+
+    for (size_t k = 0; k < 8; k++)
+    {
+        printf("    {\n");
+
+        for (size_t n = 0; n < 256; n += 8)
+        {
+            printf("       ");
+
+            for (size_t i = n; i < n + 8; i++)
+            {
+                printf(" 0x%08x,", tables[k][i]);
+            }
+
+            printf("\n");
+        }
+
+        printf("    },\n");
+    }
+
+    printf("};\n");
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int result = -1;
+
+    if (argc == 2 && strcmp(argv[1], "fixed") == 0)
+    {
+        result = print_fixed_tables();
+    }
+    else if (argc == 2 && strcmp(argv[1], "crc") == 0)
+    {
+        result = print_crc_tables();
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s fixed|crc\n", argv[0]);
+    }
+
+    return result ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+#include <libc/assert.h>
+#include <libc/errno.h>
+#include <libc/stdbool.h>
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+#include "argparse.h"
+#include "libzip.h"
+
+#define CHUNK_SIZE 32768
+
+void show_usage(char*);
+
+int compress_file(char* name);
+
+int level = DEFLATE_LEVEL_DEFAULT;
+bool to_stdout = false;
+
+int main(int argc, char** argv)
+{
+    // Parse command line arguments
+    struct Arguments args;
+    int arg_parse_result = arg_parse(&args, argc, argv);
+    assert(!arg_parse_result);
+
+    if (arg_check_short(&args, 'h') || arg_check_long(&args, "help"))
+    {
+        show_usage(argv[0]);
+        return 0;
+    }
+
+    // The highest level given is used
+    for (char c = '1'; c <= '9'; c++)
+    {
+        if (arg_check_short(&args, c))
+        {
+            level = c - '0';
+        }
+    }
+
+    if (arg_check_long(&args, "fast"))
+    {
+        level = DEFLATE_LEVEL_FASTEST;
+    }
+
+    if (arg_check_long(&args, "best"))
+    {
+        level = DEFLATE_LEVEL_BEST;
+    }
+
+    to_stdout = arg_check_short(&args, 'c') || arg_check_long(&args, "stdout");
+
+    char** to_compress = arg_get_free(&args);
+
+    if (*to_compress == 0)
+    {
+        return compress_file("-");
+    }
+
+    while (*to_compress)
+    {
+        int result = compress_file(*to_compress++);
+
+        if (result)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+// Compress a single file (or stdin for "-") to name.gz, or to stdout
+int compress_file(char* name)
+{
+    FILE* input;
+    FILE* output;
+    const char* stored_name = NULL;
+    char output_name[256];
+
+    errno = 0;
+
+    if (strcmp(name, "-") == 0)
+    {
+        input = stdin;
+        output = stdout;
+    }
+    else
+    {
+        input = fopen(name, "rb");
+
+        if (input == NULL || errno != 0)
+        {
+            fprintf(stderr, "Unable to open `%s`: %s\n", name, strerror(errno));
+            return 1;
+        }
+
+        // Only the last component of the path is stored in the header
+        stored_name = name;
+
+        for (const char* c = name; *c; c++)
+        {
+            if (*c == '/')
+            {
+                stored_name = c + 1;
+            }
+        }
+
+        if (to_stdout)
+        {
+            output = stdout;
+        }
+        else
+        {
+            if (strlen(name) + 4 > sizeof(output_name))
+            {
+                fprintf(stderr, "File name `%s` is too long\n", name);
+                return 1;
+            }
+
+            strcpy(output_name, name);
+            strcat(output_name, ".gz");
+
+            output = fopen(output_name, "wb");
+
+            if (output == NULL || errno != 0)
+            {
+                fprintf(stderr, "Unable to open `%s`: %s\n", output_name, strerror(errno));
+                return 1;
+            }
+        }
+    }
+
+    struct gzip_writer* writer = gzip_writer_init(level, stored_name, 0);
+
+    if (writer == NULL)
+    {
+        fprintf(stderr, "Unable to allocate compression state\n");
+        return 3;
+    }
+
+    // Compress the input a chunk at a time, so memory use is bounded no matter
+    // how large it is
+    static uint8_t buffer[CHUNK_SIZE];
+    bool done = false;
+
+    while (!done)
+    {
+        size_t count = fread(buffer, 1, CHUNK_SIZE, input);
+
+        if (errno != 0)
+        {
+            fprintf(stderr, "Unable to read from `%s`: %s\n", name, strerror(errno));
+            return 2;
+        }
+
+        done = count == 0;
+
+        const uint8_t* compressed;
+        size_t compressed_length;
+
+        if (gzip_writer_feed(writer, buffer, count, done, &compressed, &compressed_length))
+        {
+            fprintf(stderr, "Unable to compress `%s`\n", name);
+            return 3;
+        }
+
+        if (compressed_length > 0 && fwrite(compressed, 1, compressed_length, output) != compressed_length)
+        {
+            fprintf(stderr, "Unable to write output: %s\n", strerror(errno));
+            return 4;
+        }
+    }
+
+    gzip_writer_end(writer);
+
+    if (input != stdin)
+    {
+        fclose(input);
+    }
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+
+    if (errno != 0)
+    {
+        fprintf(stderr, "Unable to close file: %s\n", strerror(errno));
+        return 4;
+    }
+
+    return 0;
+}
+
+void show_usage(char* prog_name)
+{
+    printf("Usage: %s [OPTIONS] ... [FILE] ...\n", prog_name);
+    printf(" Compress each FILE to FILE.gz, or stdin to stdout\n\n");
+    printf("       -1 --fast          Compress faster\n");
+    printf("       -9 --best          Compress better\n");
+    printf("       -c --stdout        Write to stdout\n");
+    printf("       -h --help          Show the usage\n");
+}
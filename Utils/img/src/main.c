@@ -3,6 +3,25 @@
 #include <graphics.h>
 #include <libimg.h>
 
+// Show each pass of an interlaced image as it loads, so a coarse version of it
+// appears long before the whole image has been read
+void show_preview(struct pixel_buffer* image, int pass, void* context)
+{
+    if (image->fmt == RGBA32)
+    {
+        blit(image, 320 - image->width / 2, 240 - image->height / 2);
+        return;
+    }
+
+    struct pixel_buffer converted;
+
+    if (convert_pixel_buffer(RGBA32, &converted, image) == 0)
+    {
+        blit(&converted, 320 - converted.width / 2, 240 - converted.height / 2);
+        free_pixel_buffer(converted);
+    }
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2)
@@ -10,19 +29,22 @@ int main(int argc, char** argv)
         printf("img requires atleast one argument\n");
         return 1;
     }
-    
+
     struct pixel_buffer data;
 
-    if (load_image_format(argv[1], &data, RGBA32))
+    image_progress_callback(show_preview, NULL);
+
+    // Loading through the cache maps raw images (such as those from imgraw)
+    // rather than copying them
+    if (image_cache_load(argv[1], &data, RGBA32))
     {
         printf("Image load failed!\n");
+        return 1;
     }
 
     blit(&data, 320 - data.width / 2, 240 - data.height / 2);
 
-    free_pixel_buffer(data);
+    image_cache_release(&data);
 
     return 0;
 }
-
-
@@ -0,0 +1,140 @@
+#include <libc/assert.h>
+#include <libc/stdio.h>
+#include <libc/string.h>
+
+#include "argparse.h"
+#include "graphics.h"
+#include "libimg.h"
+
+void show_usage(char*);
+
+int convert_file(char* name);
+
+pixel_format format = RGBA32;
+
+// Formats which can be chosen on the command line
+static const struct
+{
+    char* name;
+    pixel_format fmt;
+} formats[] =
+{
+    {"rgba32", RGBA32},
+    {"bgra32", BGRA32},
+    {"rgb24", RGB24},
+    {"bgr24", BGR24},
+    {"gray8", GRAY8},
+};
+
+int main(int argc, char** argv)
+{
+    // Parse command line arguments
+    struct Arguments args;
+    int arg_parse_result = arg_parse(&args, argc, argv);
+    assert(!arg_parse_result);
+
+    if (arg_check_short(&args, 'h') || arg_check_long(&args, "help"))
+    {
+        show_usage(argv[0]);
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if (arg_check_long(&args, formats[i].name))
+        {
+            format = formats[i].fmt;
+        }
+    }
+
+    char** to_convert = arg_get_free(&args);
+
+    if (*to_convert == 0)
+    {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    while (*to_convert)
+    {
+        int result = convert_file(*to_convert++);
+
+        if (result)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+// Convert a single image to a raw image with the same name, but with its
+// extension replaced by .raw
+int convert_file(char* name)
+{
+    char output_name[256];
+
+    // Find the extension of the last component of the path, if it has one
+    char* extension = NULL;
+
+    for (char* c = name; *c; c++)
+    {
+        if (*c == '/')
+        {
+            extension = NULL;
+        }
+        else if (*c == '.')
+        {
+            extension = c;
+        }
+    }
+
+    size_t stem = extension != NULL ? (size_t)(extension - name) : strlen(name);
+
+    if (stem + 5 > sizeof(output_name))
+    {
+        printf("File name `%s` is too long\n", name);
+        return 1;
+    }
+
+    memcpy(output_name, name, stem);
+    strcpy(output_name + stem, ".raw");
+
+    if (strcmp(output_name, name) == 0)
+    {
+        printf("`%s` is already a raw image\n", name);
+        return 1;
+    }
+
+    struct pixel_buffer image;
+
+    if (load_image_format(name, &image, format))
+    {
+        printf("Unable to load `%s`\n", name);
+        return 2;
+    }
+
+    int result = image_save_raw(output_name, &image);
+    free_pixel_buffer(image);
+
+    if (result)
+    {
+        printf("Unable to write `%s`\n", output_name);
+        return 3;
+    }
+
+    return 0;
+}
+
+void show_usage(char* prog_name)
+{
+    printf("Usage: %s [OPTIONS] ... [FILE] ...\n", prog_name);
+    printf(" Decode each FILE to a raw image, FILE with its extension replaced\n");
+    printf(" by .raw, which loads without any decoding\n\n");
+    printf("          --rgba32        Store the pixels as RGBA32 (the default)\n");
+    printf("          --bgra32        Store the pixels as BGRA32\n");
+    printf("          --rgb24         Store the pixels as RGB24\n");
+    printf("          --bgr24         Store the pixels as BGR24\n");
+    printf("          --gray8         Store the pixels as GRAY8\n");
+    printf("       -h --help          Show the usage\n");
+}
@@ -1,141 +1,555 @@
 #include <libc/errno.h>
+#include <libc/fcntl.h>
 #include <libc/stdio.h>
 #include <libc/stdlib.h>
 #include <libc/string.h>
+#include <libc/sys/stat.h>
+#include <libc/sys/syscalls.h>
+#include <libc/unistd.h>
 
 #include "libzip.h"
+#include "parallel.h"
 
-// Main Entry Point
-int main(int argc, char** argv)
+#define CHUNK_SIZE 4096
+
+// Compressed input read from a file a chunk at a time
+struct input
 {
-    // Output file name
-    const char* output_filename = "out";
+    FILE* file;
+    uint8_t buffer[CHUNK_SIZE];
+    size_t length;
+    size_t offset;
+};
 
-    // Check to see if we are given the filename to read in
-    if (argc < 2)
+// Read the next chunk of the file, keeping any bytes not yet used, returns the number of new bytes
+size_t fill_input(struct input* in)
+{
+    memmove(in->buffer, in->buffer + in->offset, in->length - in->offset);
+    in->length -= in->offset;
+    in->offset = 0;
+
+    size_t count = fread(in->buffer + in->length, 1, CHUNK_SIZE - in->length, in->file);
+    in->length += count;
+
+    return count;
+}
+
+// Read a single byte from the input, returns -1 at the end of the file
+int input_byte(struct input* in)
+{
+    if (in->offset == in->length && fill_input(in) == 0)
     {
-        printf("Please provide a file to decompress.\n");
+        return -1;
+    }
+
+    return in->buffer[in->offset++];
+}
+
+// Parse a decimal number, returns -1 if the string is not a valid number
+int parse_number(const char* text, uint64_t* value)
+{
+    *value = 0;
+
+    if (*text == 0)
+    {
+        return -1;
+    }
+
+    while (*text)
+    {
+        if (*text < '0' || *text > '9')
+        {
+            return -1;
+        }
+
+        *value = *value * 10 + (*text++ - '0');
+    }
+
+    return 0;
+}
+
+// Map a whole file into memory, storing its length and file descriptor.
+// Returns a null pointer (after printing an error) on failure.
+void* map_file(const char* filename, size_t* length, int* fd)
+{
+    // Attempt to stat the file to determine its length
+    struct stat data;
+    int result = stat(filename, &data);
+
+    if (result < 0)
+    {
+        printf("Unable to stat `%s`: %s\n", filename, strerror(-result));
+        return NULL;
+    }
+
+    *length = data.st_size;
+    *fd = open(filename, O_RDONLY);
+
+    if (*fd < 0)
+    {
+        printf("Unable to open `%s`: %s\n", filename, strerror(-*fd));
+        return NULL;
+    }
+
+    // The archive is mapped rather than read, so only the parts of it which
+    // are used need to be loaded
+    void* mapped = sys_mmap(0, *length, PROT_READ, MAP_SHARED, *fd, 0);
+
+    if ((long)mapped < 0)
+    {
+        printf("Unable to map `%s`: %s\n", filename, strerror(-(long)mapped));
+        close(*fd);
+        return NULL;
+    }
+
+    return mapped;
+}
+
+// Write length bytes of the decompressed data starting at offset to stdout,
+// reading through the index. Returns 0 on success, or the exit code to fail
+// with.
+int write_range(const struct gzip_index* index, const void* archive, size_t file_length, uint64_t offset, uint64_t length)
+{
+    struct gzip_reader* reader = gzip_reader_open(index, archive, file_length, offset);
+
+    if (reader == NULL)
+    {
+        printf("Unable to allocate decompression state.\n");
+        return 7;
+    }
+
+    static uint8_t output[CHUNK_SIZE];
+    int result = 0;
+
+    while (length > 0 && result == 0)
+    {
+        size_t produced;
+
+        if (gzip_reader_read(reader, output, length < CHUNK_SIZE ? length : CHUNK_SIZE, &produced))
+        {
+            printf("Unable to decompress data.\n");
+            result = 7;
+        }
+        else if (produced == 0)
+        {
+            break;
+        }
+        else if (fwrite(output, 1, produced, stdout) != produced)
+        {
+            printf("Unable to write output: %s\n", strerror(errno));
+            result = 9;
+        }
+        else
+        {
+            length -= produced;
+        }
+    }
+
+    gzip_reader_end(reader);
+
+    return result;
+}
+
+// Write length bytes of the decompressed data starting at offset to stdout,
+// using the index stored alongside the archive (which is built on first use)
+int extract_range(const char* filename, uint64_t offset, uint64_t length)
+{
+    char index_filename[256];
+
+    if (strlen(filename) + 5 > sizeof(index_filename))
+    {
+        printf("File name `%s` is too long\n", filename);
         return 1;
     }
 
-    // Get the filename as its own variable
-    const char* filename = argv[1];
+    strcpy(index_filename, filename);
+    strcat(index_filename, ".gzi");
 
-    // Before doing any reading from files, make sure errno is in a known state
-    errno = 0;
+    size_t file_length;
+    int fd;
+    void* archive = map_file(filename, &file_length, &fd);
 
-    // Attempt to open the file
-    FILE* file = fopen(filename, "rb");
-    
-    // Print out an error message if an error occurs
-    if (file == NULL || errno != 0)
+    if (archive == NULL)
     {
-        printf("Unable to open `%s`: %s\n", filename, strerror(errno));
         return 2;
     }
 
-    // Read the first 4KiB of the file into memory, this will hopefully be enough for now
-    // TODO: Change this to dynamically allocate the size of the file
-    uint8_t buffer[4096];
-    fread(buffer, 1, 4096, file);
+    struct gzip_index* index = gzip_index_load(index_filename, archive, file_length);
 
-    // Print out an error message if the read failed
-    if (errno != 0)
+    if (index == NULL)
     {
-        printf("Unable to read from file: %s\n", strerror(errno));
-        return 3;
+        index = gzip_index_build(archive, file_length, GZIP_INDEX_SPAN);
+
+        if (index == NULL)
+        {
+            printf("Unable to index `%s`\n", filename);
+        }
+        // Failing to save the index only costs time on the next run
+        else if (gzip_index_save(index, index_filename))
+        {
+            printf("Unable to save index to `%s`\n", index_filename);
+        }
     }
 
-    // Close the file handle we were given
-    fclose(file);
+    int result = 7;
 
-    // Print out an error message if we were unable to close the file
-    if (errno != 0)
+    if (index != NULL)
     {
-        printf("Unable to close file: %s\n", strerror(errno));
-        return 4;
+        result = write_range(index, archive, file_length, offset, length);
+        gzip_index_free(index);
+    }
+
+    sys_munmap(archive, file_length);
+    close(fd);
+
+    return result;
+}
+
+// List the members of a zip archive, or write the one called member to stdout
+// if it is not a null pointer
+int zip_archive_mode(const char* filename, const char* member)
+{
+    size_t file_length;
+    int fd;
+    void* data = map_file(filename, &file_length, &fd);
+
+    if (data == NULL)
+    {
+        return 2;
     }
 
+    struct zip_archive* archive = zip_open(data, file_length);
+
+    if (archive == NULL)
+    {
+        return 5;
+    }
+
+    int result = 0;
+
+    if (member == NULL)
+    {
+        printf("      Size  Compressed  Name\n");
+
+        for (size_t i = 0; i < zip_entry_count(archive); i++)
+        {
+            const struct zip_entry* entry = zip_entry_at(archive, i);
+            printf("%10u  %10u  %s\n", entry->size, entry->compressed_size, entry->name);
+        }
+    }
+    else
+    {
+        long index = zip_find(archive, member);
+        size_t length;
+        uint8_t* contents = index < 0 ? NULL : zip_extract(archive, index, &length, 1);
+
+        if (index < 0)
+        {
+            printf("`%s` is not in the archive.\n", member);
+            result = 6;
+        }
+        else if (contents == NULL)
+        {
+            printf("Unable to decompress data.\n");
+            result = 7;
+        }
+        else if (fwrite(contents, 1, length, stdout) != length)
+        {
+            printf("Unable to write output: %s\n", strerror(errno));
+            result = 9;
+        }
+
+        free(contents);
+    }
+
+    zip_close(archive);
+    sys_munmap(data, file_length);
+    close(fd);
+
+    return result;
+}
+
+// Read the header of a member, storing the original filename (if it has one)
+// in name, which holds name_length bytes. Returns 0 on success, or the exit
+// code to fail with.
+int read_member_header(struct input* in, char* name, size_t name_length)
+{
     // Check to see if the file is a gzip archive by checking the magic number
-    if (buffer[0] != GZIP_MAGIC0 || buffer[1] != GZIP_MAGIC1)
+    if (input_byte(in) != GZIP_MAGIC0 || input_byte(in) != GZIP_MAGIC1)
     {
         printf("File is not a gzip archive\n");
         return 5;
     }
 
     // Make sure the archive was compressed using DEFLATE
-    if (buffer[2] != CM_DEFLATE)
+    if (input_byte(in) != CM_DEFLATE)
     {
         printf("File was not compressed using deflate\n");
         return 6;
     }
 
     // Store the compression flags
-    uint8_t flags = buffer[3];
-
-    // Offset into the buffer from the file
-    size_t offset = 4;
+    uint8_t flags = input_byte(in);
 
     // Skip past the modified time, xfl, and os fields
-    offset += 4 + 1 + 1;
+    for (size_t i = 0; i < 4 + 1 + 1; i++)
+    {
+        input_byte(in);
+    }
 
     // Skip past any extra data stored within the header
     if (flags & FEXTRA)
     {
         // Extract the length of the extra data
-        uint16_t length = *(uint16_t*)(buffer + offset);
-
-        // Skip past the length parameter and the extra data
-        offset += 2 + length;
+        uint16_t length = input_byte(in);
+        length |= input_byte(in) << 8;
+
+        // Skip past the extra data
+        for (size_t i = 0; i < length; i++)
+        {
+            input_byte(in);
+        }
     }
 
     // Skip past the original filename
     if (flags & FNAME)
     {
         // Extract the name
-        const char* name = (const char*)buffer + offset;
-
-        output_filename = name;
-
-        // Print the name
-        // printf("Original Name: `%s`\n", name);
-
-        // Move past the name
-        offset += strlen(name) + 1;
+        size_t i = 0;
+        int c;
+
+        while ((c = input_byte(in)) > 0)
+        {
+            if (i + 1 < name_length)
+            {
+                name[i++] = c;
+            }
+        }
+
+        if (name_length > 0)
+        {
+            name[i] = 0;
+        }
     }
-    
+
     // Skip past any comments stored in the header
     if (flags & FCOMMENT)
     {
-        // Extract the comment
-        const char* comment = (const char*)buffer + offset;
-
-        // Print the comment
-        // printf("Comment: `%s`\n", comment);
-
-        // Move past the comment
-        offset += strlen(comment) + 1;
+        while (input_byte(in) > 0);
     }
 
     // Skip past the crc data if present
     if (flags & FHCRC)
     {
         // Skip the 16 bits
-        offset += 2;
+        input_byte(in);
+        input_byte(in);
     }
 
-    // Now, finally we are at the compressed data
-    size_t length;
-    uint8_t* data = deflate_decompress(buffer + offset, &length);
+    return 0;
+}
 
-    // Check if the decompressed data is NULL, and display an error message if so
-    if (data == NULL)
+// Whether the unread input starts with what looks like the header of another
+// member, rather than trailing data or the end of the file
+int at_member(struct input* in)
+{
+    if (in->length - in->offset < 4)
+    {
+        fill_input(in);
+    }
+
+    const uint8_t* bytes = in->buffer + in->offset;
+
+    return in->length - in->offset >= 4 && bytes[0] == GZIP_MAGIC0 && bytes[1] == GZIP_MAGIC1 && bytes[2] == CM_DEFLATE && (bytes[3] & 0xE0) == 0;
+}
+
+// Decompress the member following its header a chunk at a time, writing the
+// output to a file and checking it against the trailer. Returns 0 on success,
+// or the exit code to fail with.
+int decompress_member(struct input* in, FILE* outf)
+{
+    struct inflate_state* state = inflate_init();
+
+    if (state == NULL)
+    {
+        printf("Unable to allocate decompression state.\n");
+        return 7;
+    }
+
+    // The crc is computed over each chunk of output as it is produced
+    inflate_set_check(state, INFLATE_CHECK_CRC32);
+
+    static uint8_t output[CHUNK_SIZE];
+    size_t total = 0;
+    int status = INFLATE_OK;
+
+    while (status == INFLATE_OK)
+    {
+        size_t consumed;
+        size_t produced;
+
+        status = inflate_feed(state, in->buffer + in->offset, in->length - in->offset, &consumed, output, CHUNK_SIZE, &produced);
+        in->offset += consumed;
+        total += produced;
+
+        fwrite(output, 1, produced, outf);
+
+        // Print out an error message if the write failed
+        if (errno != 0)
+        {
+            printf("Unable to write to file: %s\n", strerror(errno));
+            return 9;
+        }
+
+        // Only read more of the file once the decompressor has run out of input
+        if (status == INFLATE_OK && produced < CHUNK_SIZE && fill_input(in) == 0)
+        {
+            printf("Compressed data is truncated.\n");
+            return 7;
+        }
+    }
+
+    uint32_t crc = inflate_check_value(state);
+    inflate_end(state);
+
+    // Check if the decompression failed, and display an error message if so
+    if (status != INFLATE_DONE)
     {
         printf("Unable to decompress data.\n");
         return 7;
     }
 
-    printf("%s\n", data);
+    // Check the crc and uncompressed size stored in the trailer
+    uint32_t trailer[2] = {0, 0};
+
+    for (size_t i = 0; i < 8; i++)
+    {
+        int c = input_byte(in);
+        trailer[i / 4] |= (uint32_t)(c < 0 ? 0 : c) << (8 * (i % 4));
+    }
+
+    if (trailer[0] != crc)
+    {
+        printf("Decompressed data is corrupt (crc mismatch).\n");
+        return 7;
+    }
+
+    if (trailer[1] != (uint32_t)total)
+    {
+        printf("Decompressed size does not match the archive.\n");
+        return 7;
+    }
+
+    return 0;
+}
+
+// Main Entry Point
+int main(int argc, char** argv)
+{
+    // Output file name
+    char output_filename[256] = "out";
+
+    // Get the filename and the range to extract, if any. The range takes values,
+    // which argparse does not support, so the arguments are handled directly.
+    const char* filename = NULL;
+    uint64_t offset = 0;
+    uint64_t length = ~(uint64_t)0;
+    uint64_t jobs = 0;
+    int random_access = 0;
+    int zip_list = 0;
+    const char* zip_member = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--jobs") == 0)
+        {
+            if (i + 1 == argc || parse_number(argv[i + 1], &jobs))
+            {
+                printf("`%s` needs a number.\n", argv[i]);
+                return 1;
+            }
+
+            i++;
+        }
+        else if (strcmp(argv[i], "--offset") == 0 || strcmp(argv[i], "--length") == 0)
+        {
+            if (i + 1 == argc || parse_number(argv[i + 1], strcmp(argv[i], "--offset") == 0 ? &offset : &length))
+            {
+                printf("`%s` needs a number.\n", argv[i]);
+                return 1;
+            }
+
+            random_access = 1;
+            i++;
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            zip_list = 1;
+        }
+        else if (strcmp(argv[i], "-x") == 0)
+        {
+            if (i + 1 == argc)
+            {
+                printf("`%s` needs a member name.\n", argv[i]);
+                return 1;
+            }
+
+            zip_member = argv[++i];
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+
+    // Check to see if we are given the filename to read in
+    if (filename == NULL)
+    {
+        printf("Please provide a file to decompress.\n");
+        return 1;
+    }
+
+    if (random_access)
+    {
+        return extract_range(filename, offset, length);
+    }
+
+    // Zip archives are either listed or have a single member extracted
+    if (zip_list || zip_member != NULL)
+    {
+        return zip_archive_mode(filename, zip_member);
+    }
+
+    // Before doing any reading from files, make sure errno is in a known state
+    errno = 0;
+
+    // Attempt to open the file
+    static struct input in;
+    in.file = fopen(filename, "rb");
+
+    // Print out an error message if an error occurs
+    if (in.file == NULL || errno != 0)
+    {
+        printf("Unable to open `%s`: %s\n", filename, strerror(errno));
+        return 2;
+    }
+
+    // Read the start of the file, which holds the header
+    fill_input(&in);
+
+    // Print out an error message if the read failed
+    if (errno != 0)
+    {
+        printf("Unable to read from file: %s\n", strerror(errno));
+        return 3;
+    }
+
+    int result = read_member_header(&in, output_filename, sizeof(output_filename));
+
+    if (result)
+    {
+        return result;
+    }
 
     // Open the output file
     FILE* outf = fopen(output_filename, "wb");
@@ -147,16 +561,64 @@ int main(int argc, char** argv)
         return 8;
     }
 
-    fwrite(data, 1, length, outf);
+    // When jobs are given, every member is handed to a worker, with that many
+    // members decompressed at once
+    if (jobs > 0)
+    {
+        fclose(in.file);
 
-    // Print out an error message if the write failed
-    if (errno != 0)
+        size_t file_length;
+        int fd;
+        void* archive = map_file(filename, &file_length, &fd);
+
+        if (archive == NULL)
+        {
+            return 2;
+        }
+
+        result = parallel_decompress(archive, file_length, outf, jobs > MAX_JOBS ? MAX_JOBS : jobs);
+
+        sys_munmap(archive, file_length);
+        close(fd);
+
+        if (fclose(outf) && result == 0)
+        {
+            printf("Unable to close file: %s\n", strerror(errno));
+            return 10;
+        }
+
+        return result;
+    }
+
+    // Now, finally we are at the compressed data. A file can hold several
+    // members one after another, whose output is joined together.
+    while ((result = decompress_member(&in, outf)) == 0)
+    {
+        if (!at_member(&in))
+        {
+            if (in.offset < in.length)
+            {
+                printf("Ignoring trailing data after the last member.\n");
+            }
+
+            break;
+        }
+
+        result = read_member_header(&in, NULL, 0);
+
+        if (result)
+        {
+            break;
+        }
+    }
+
+    if (result)
     {
-        printf("Unable to write to file: %s\n", strerror(errno));
-        return 9;
+        return result;
     }
 
-    // Close the file handle we were given
+    // Close the file handles we were given
+    fclose(in.file);
     fclose(outf);
 
     // Print out an error message if we were unable to close the file
@@ -166,8 +628,5 @@ int main(int argc, char** argv)
         return 10;
     }
 
-    // Free the buffer with the decompressed data
-    free(data);
-
     return 0;
 }
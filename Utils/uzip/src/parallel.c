@@ -0,0 +1,487 @@
+#include "parallel.h"
+
+#include <libc/stdbool.h>
+#include <libc/stdlib.h>
+#include <libc/string.h>
+
+// When built for the host, threads are used as workers instead of processes
+#ifdef __linux__
+#include <pthread.h>
+#else
+#include <libc/sys/syscalls.h>
+#endif
+
+#include "libzip.h"
+
+#define CHUNK_SIZE 32768
+
+/*
+    Member boundaries cannot be found without decompressing, so every place
+    which looks like the start of a member (the magic number, the compression
+    method and no reserved flags) is handed to a worker, which decompresses a
+    single member from there and reports where it ended. The results are taken
+    in order from the start of the file: a result is used if it starts where
+    the previous member ended, and is otherwise thrown away, as the magic
+    number just happened to appear inside the compressed data.
+
+    A worker holds the whole of its member until its result is taken. Once
+    the output outgrows its first chunk (which false matches rarely do) it is
+    grown straight to the size in the trailer at the end of the file, which is
+    exact when the member is the last (or only) one, and doubles from there
+    otherwise.
+*/
+
+// Outcome of decompressing a single member, which is followed by the
+// decompressed data when sent back by a worker process
+struct member_header
+{
+    // Zero if the member was decompressed and its trailer matched
+    int32_t status;
+
+    // Offset just past the trailer, and the length of the decompressed data
+    uint64_t end;
+    uint64_t length;
+};
+
+struct worker
+{
+    const uint8_t* data;
+    size_t length;
+    size_t start;
+
+    struct member_header header;
+    uint8_t* output;
+
+#ifdef __linux__
+    pthread_t thread;
+#else
+    int pid;
+    int fd;
+#endif
+};
+
+// Read a little endian 32 bit value
+static uint32_t read_u32(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Find the next offset at or after from which looks like the start of a
+// member, returns length if there are none
+static size_t next_candidate(const uint8_t* data, size_t length, size_t from)
+{
+    while (from + 10 <= length)
+    {
+        const uint8_t* found = memchr(data + from, GZIP_MAGIC0, length - from - 9);
+
+        if (found == NULL)
+        {
+            break;
+        }
+
+        from = found - data;
+
+        if (found[1] == GZIP_MAGIC1 && found[2] == CM_DEFLATE && (found[3] & 0xE0) == 0)
+        {
+            return from;
+        }
+
+        from++;
+    }
+
+    return length;
+}
+
+// Expected size of the output of a member starting at position, which is the
+// size in the trailer at the end of the file as long as the rest of the file
+// could expand to it, or 0 if it can't be trusted
+static size_t expected_size(const uint8_t* data, size_t length, size_t position)
+{
+    uint64_t size = read_u32(data + length - 4);
+
+    if (size > (uint64_t)(length - position) * MAX_DEFLATE_RATIO)
+    {
+        return 0;
+    }
+
+    return size;
+}
+
+// Decompress the member starting at the worker's start offset into a newly
+// allocated buffer, checking it against the trailer
+static void decompress_member(struct worker* worker)
+{
+    const uint8_t* data = worker->data;
+    size_t length = worker->length;
+    size_t position = worker->start + gzip_header_length(data + worker->start, length - worker->start);
+
+    worker->header = (struct member_header){.status = -1, .end = 0, .length = 0};
+    worker->output = NULL;
+
+    struct inflate_state* state = inflate_init();
+
+    if (state == NULL)
+    {
+        return;
+    }
+
+    inflate_set_check(state, INFLATE_CHECK_CRC32);
+
+    size_t expected = expected_size(data, length, position);
+    uint8_t* output = NULL;
+    size_t capacity = 0;
+    size_t total = 0;
+    int status = INFLATE_OK;
+
+    while (status == INFLATE_OK)
+    {
+        if (total == capacity)
+        {
+            size_t grown_capacity = capacity ? capacity * 2 : CHUNK_SIZE;
+
+            // A byte more than expected is left so that the end of the
+            // member is reached without running out of space
+            if (capacity != 0 && expected >= grown_capacity)
+            {
+                grown_capacity = expected + 1;
+            }
+
+            uint8_t* grown = realloc(output, grown_capacity);
+
+            // Fall back to doubling if the expected size can't be allocated
+            if (grown == NULL && capacity != 0 && grown_capacity > capacity * 2)
+            {
+                grown_capacity = capacity * 2;
+                grown = realloc(output, grown_capacity);
+            }
+
+            if (grown == NULL)
+            {
+                status = INFLATE_ERROR;
+                break;
+            }
+
+            output = grown;
+            capacity = grown_capacity;
+        }
+
+        size_t consumed;
+        size_t produced;
+
+        status = inflate_feed(state, data + position, length - position, &consumed, output + total, capacity - total, &produced);
+        position += consumed;
+        total += produced;
+
+        // All of the remaining data was given, so stopping with space left
+        // means the member is truncated
+        if (status == INFLATE_OK && total < capacity)
+        {
+            break;
+        }
+    }
+
+    uint32_t crc = inflate_check_value(state);
+    inflate_end(state);
+
+    if (status == INFLATE_DONE && length - position >= 8 && read_u32(data + position) == crc && read_u32(data + position + 4) == (uint32_t)total)
+    {
+        worker->header = (struct member_header){.status = 0, .end = position + 8, .length = total};
+        worker->output = output;
+    }
+    else
+    {
+        free(output);
+    }
+}
+
+#ifdef __linux__
+
+static void* worker_thread(void* worker)
+{
+    decompress_member(worker);
+    return NULL;
+}
+
+// Start decompressing the worker's member, returns 0 on success and -1 if the
+// worker could not be started
+static int start_worker(struct worker* worker)
+{
+    return pthread_create(&worker->thread, NULL, worker_thread, worker) ? -1 : 0;
+}
+
+// Wait for the worker to finish, and fill in its header
+static void wait_worker(struct worker* worker)
+{
+    pthread_join(worker->thread, NULL);
+}
+
+// Write out the decompressed data of a finished worker, or throw it away if
+// output is a null pointer. Returns 0 on success and -1 if the write failed.
+static int take_output(struct worker* worker, FILE* output)
+{
+    int result = 0;
+
+    if (output != NULL && fwrite(worker->output, 1, worker->header.length, output) != worker->header.length)
+    {
+        result = -1;
+    }
+
+    free(worker->output);
+
+    return result;
+}
+
+#else
+
+// Write all of the bytes to a file descriptor, returns 0 on success
+static int write_all(int fd, const void* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        int count = sys_write(fd, buffer, length);
+
+        if (count <= 0)
+        {
+            return -1;
+        }
+
+        buffer = (const uint8_t*)buffer + count;
+        length -= count;
+    }
+
+    return 0;
+}
+
+// Read exactly length bytes from a file descriptor, returns 0 on success
+static int read_all(int fd, void* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        int count = sys_read(fd, buffer, length);
+
+        if (count <= 0)
+        {
+            return -1;
+        }
+
+        buffer = (uint8_t*)buffer + count;
+        length -= count;
+    }
+
+    return 0;
+}
+
+// Start decompressing the worker's member, returns 0 on success and -1 if the
+// worker could not be started
+static int start_worker(struct worker* worker)
+{
+    int fds[2];
+
+    if (sys_pipe(fds) < 0)
+    {
+        return -1;
+    }
+
+    int pid = sys_fork();
+
+    if (pid < 0)
+    {
+        sys_close(fds[0]);
+        sys_close(fds[1]);
+        return -1;
+    }
+
+    // As the child, decompress the member and send the result back through
+    // the pipe
+    if (pid == 0)
+    {
+        sys_close(fds[0]);
+
+        decompress_member(worker);
+
+        if (write_all(fds[1], &worker->header, sizeof(struct member_header)) == 0 && worker->header.status == 0)
+        {
+            write_all(fds[1], worker->output, worker->header.length);
+        }
+
+        sys_exit(0);
+    }
+
+    // As the parent
+    sys_close(fds[1]);
+
+    worker->pid = pid;
+    worker->fd = fds[0];
+
+    return 0;
+}
+
+// Wait for the worker to finish, and fill in its header
+static void wait_worker(struct worker* worker)
+{
+    if (read_all(worker->fd, &worker->header, sizeof(struct member_header)))
+    {
+        worker->header.status = -1;
+    }
+}
+
+// Workers which have exited but were reaped while waiting for another one
+static int exited[MAX_JOBS];
+static size_t exited_count = 0;
+
+// Wait for the worker's process to exit. There is no way to wait for a
+// particular process, so any other worker reaped along the way is remembered
+// until its own turn comes.
+static void reap_worker(struct worker* worker)
+{
+    for (size_t i = 0; i < exited_count; i++)
+    {
+        if (exited[i] == worker->pid)
+        {
+            exited[i] = exited[--exited_count];
+            return;
+        }
+    }
+
+    while (true)
+    {
+        int pid = sys_wait(NULL);
+
+        if (pid < 0 || pid == worker->pid)
+        {
+            return;
+        }
+
+        if (exited_count < MAX_JOBS)
+        {
+            exited[exited_count++] = pid;
+        }
+    }
+}
+
+// Write out the decompressed data of a finished worker, or throw it away if
+// output is a null pointer. Returns 0 on success and -1 if the write failed.
+static int take_output(struct worker* worker, FILE* output)
+{
+    static uint8_t buffer[CHUNK_SIZE];
+    uint64_t remaining = worker->header.status == 0 ? worker->header.length : 0;
+    int result = 0;
+
+    // The data is always read in full, so the worker never blocks on the pipe
+    while (remaining > 0)
+    {
+        size_t count = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+
+        if (read_all(worker->fd, buffer, count))
+        {
+            result = -1;
+            break;
+        }
+
+        if (output != NULL && fwrite(buffer, 1, count, output) != count)
+        {
+            result = -1;
+        }
+
+        remaining -= count;
+    }
+
+    sys_close(worker->fd);
+    reap_worker(worker);
+
+    return result;
+}
+
+#endif
+
+// Decompress every member of a gzip file held in memory, with up to jobs
+// members decompressed at once by separate workers. The output is written in
+// order. Returns 0 on success, or the exit code to fail with.
+int parallel_decompress(const uint8_t* data, size_t length, FILE* output, int jobs)
+{
+    static struct worker workers[MAX_JOBS];
+
+    if (jobs < 1)
+    {
+        jobs = 1;
+    }
+    else if (jobs > MAX_JOBS)
+    {
+        jobs = MAX_JOBS;
+    }
+
+    if (next_candidate(data, length, 0) != 0)
+    {
+        printf("File is not a gzip archive\n");
+        return 5;
+    }
+
+    // Running workers are kept in the order they were started
+    size_t first = 0;
+    size_t running = 0;
+
+    size_t scan = 0;
+    size_t position = 0;
+    int result = 0;
+
+    while (true)
+    {
+        // Keep every worker busy until something fails
+        while (result == 0 && running < (size_t)jobs && (scan = next_candidate(data, length, scan)) < length)
+        {
+            struct worker* worker = &workers[(first + running) % jobs];
+            worker->data = data;
+            worker->length = length;
+            worker->start = scan++;
+
+            if (start_worker(worker))
+            {
+                printf("Unable to start a worker.\n");
+                result = 7;
+                break;
+            }
+
+            running++;
+        }
+
+        if (running == 0)
+        {
+            break;
+        }
+
+        struct worker* worker = &workers[first];
+        first = (first + 1) % jobs;
+        running--;
+
+        wait_worker(worker);
+
+        // Anything which does not start where the last member ended was a
+        // false match inside a member
+        bool used = result == 0 && worker->start == position;
+
+        if (used && worker->header.status != 0)
+        {
+            printf("Unable to decompress data.\n");
+            result = 7;
+            used = false;
+        }
+
+        if (take_output(worker, used ? output : NULL))
+        {
+            printf("Unable to write to file.\n");
+            result = 9;
+        }
+
+        if (used)
+        {
+            position = worker->header.end;
+        }
+    }
+
+    if (result == 0 && position < length)
+    {
+        printf("Ignoring trailing data after the last member.\n");
+    }
+
+    return result;
+}
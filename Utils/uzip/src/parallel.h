@@ -0,0 +1,16 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <libc/stdint.h>
+#include <libc/stddef.h>
+#include <libc/stdio.h>
+
+// Largest number of members which are decompressed at once
+#define MAX_JOBS 16
+
+// Decompress every member of a gzip file held in memory, with up to jobs
+// members decompressed at once by separate workers. The output is written in
+// order. Returns 0 on success, or the exit code to fail with.
+int parallel_decompress(const uint8_t* data, size_t length, FILE* output, int jobs);
+
+#endif // _PARALLEL_H
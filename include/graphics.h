@@ -63,6 +63,7 @@ void free_pixel_buffer(struct pixel_buffer buffer);
 struct pixel_buffer alloc_pixel_buffer(pixel_format fmt, size_t width, size_t height);
 
 // Attempts to convert the format of the pixel_buffer. Note that this function allocates a new buffer, meaning the original buffer must be freed seperately.
+// Returns -1, with nothing allocated, if either format isn't supported.
 int convert_pixel_buffer(pixel_format dest_format, struct pixel_buffer* dest, struct pixel_buffer* src);
 
 // Blit a subset of one pixel buffer to a subset of another, returns 0 on success, nonzero on failure
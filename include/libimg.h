@@ -1,10 +1,32 @@
 #ifndef LIBIMG_H
 #define LIBIMG_H
 
+#include <libc/stdbool.h>
 #include <libc/stddef.h>
 
 #include "pixelbuffer.h"
 
+// Called while an interlaced image is loaded, once each pass over it has been
+// decoded, with the number of that pass (1 to 6). Until the load returns the
+// image is a preview, with every pixel decoded so far filling the area around
+// it. The image is in the format it was decoded to, which may not be the
+// format asked for.
+typedef void (*image_progress_fn)(struct pixel_buffer* image, int pass, void* context);
+
+// Size and layout of an image file, as read from its header by image_probe
+struct image_info
+{
+    size_t width; // Width in pixels
+    size_t height; // Height in pixels
+
+    // Format load_image decodes the image to, except that a png with a
+    // transparent color (given after the header) decodes to RGBA32
+    pixel_format fmt;
+
+    uint8_t bit_depth; // Bits per sample (or palette index) in the file
+    bool interlaced; // Whether the pixels are stored over several passes
+};
+
 // Load an image from file into a buffer which can later be free()ed. Returns
 // -1 on failure, and 0 on success.
 int load_image(const char* filename, struct pixel_buffer* data);
@@ -13,4 +35,47 @@ int load_image(const char* filename, struct pixel_buffer* data);
 // Returns -1 on failure and 0 on success.
 int load_image_format(const char* filename, struct pixel_buffer* data, pixel_format fmt);
 
+// Write an image to a file in the raw format, which holds the pixels exactly
+// as they are in memory so it can be loaded with no decoding at all. Returns
+// -1 on failure and 0 on success.
+int image_save_raw(const char* filename, struct pixel_buffer* data);
+
+// Write an image to a file as a quite ok image, which is small and quick to
+// decode. Returns -1 on failure and 0 on success.
+int image_save_qoi(const char* filename, struct pixel_buffer* data);
+
+// Read the size and layout of an image from the header of the file, without
+// loading the image itself. Returns -1 on failure and 0 on success.
+int image_probe(const char* filename, struct image_info* info);
+
+// Load an image through the cache, in the given format. The pixels are shared
+// with every other load of the same file in the same format, so they must not
+// be changed, and the buffer must be given back with image_cache_release
+// rather than freed. A raw image already in the format is mapped and used
+// where it is, without a copy. Returns -1 on failure and 0 on success.
+int image_cache_load(const char* filename, struct pixel_buffer* data, pixel_format fmt);
+
+// Give back an image loaded with image_cache_load, which is then kept for as
+// long as it fits within the budget
+void image_cache_release(struct pixel_buffer* data);
+
+// Set the number of bytes of decoded images which nothing holds that the cache
+// keeps, on top of those which are still held. The default is 4 MiB, and 0
+// keeps nothing which isn't in use.
+void image_cache_budget(size_t bytes);
+
+// Choose whether images loaded through the cache are also written, decoded,
+// next to the file (as the name of the file followed by the format in hex and
+// .raw), so that later loads in any process can map them instead of decoding
+// the file. This is off by default.
+void image_cache_persist(bool persist);
+
+// Choose whether the checksums stored in image files (such as the chunk crcs of
+// a png) are verified while loading, this is on by default
+void image_verify_checksums(bool verify);
+
+// Choose a function to call as each pass of an interlaced image is loaded, or a
+// null pointer for none (the default). The context is passed along to it.
+void image_progress_callback(image_progress_fn callback, void* context);
+
 #endif // LIBIMG_H
\ No newline at end of file
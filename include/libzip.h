@@ -9,16 +9,269 @@
 
 #define CM_DEFLATE 8
 
+// DEFLATE cannot expand data by more than this factor, which bounds how much
+// a (possibly corrupt) size stored alongside the data is trusted
+#define MAX_DEFLATE_RATIO 1032
+
 #define FTEXT 1
 #define FHCRC 2
 #define FEXTRA 4
 #define FNAME 8
 #define FCOMMENT 16
 
+// Return values of inflate_feed
+#define INFLATE_OK 0
+#define INFLATE_DONE 1
+#define INFLATE_ERROR -1
+#define INFLATE_BLOCK 2
+
+// Checksums which can be kept over the output of inflate_feed
+#define INFLATE_CHECK_NONE 0
+#define INFLATE_CHECK_CRC32 1
+#define INFLATE_CHECK_ADLER32 2
+
+// State of an incremental decompression
+struct inflate_state;
+
+// Compression methods of zip archive members which can be extracted
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATE 8
+
+// Central directory of an open zip archive
+struct zip_archive;
+
+// A member of a zip archive, as described by the central directory
+struct zip_entry
+{
+    // Full path of the member within the archive, null terminated
+    const char* name;
+
+    uint16_t flags;
+    uint16_t method;
+    uint32_t crc;
+    uint32_t compressed_size;
+    uint32_t size;
+
+    // Offset of the local header, which comes before the data
+    uint32_t offset;
+};
+
+// Default distance between the checkpoints of a gzip index
+#define GZIP_INDEX_SPAN (1024 * 1024)
+
+// Checkpoints for random access into gzip data, and a reader starting from one
+struct gzip_index;
+struct gzip_reader;
+
+// Compression levels
+#define DEFLATE_LEVEL_STORE 0
+#define DEFLATE_LEVEL_FASTEST 1
+#define DEFLATE_LEVEL_DEFAULT 6
+#define DEFLATE_LEVEL_BEST 9
+
+// State of an incremental compression
+struct deflate_state;
+
+// State of a gzip member being written
+struct gzip_writer;
+
 
 // Decompress data stored in the DEFLATE format, this will return a buffer
 // which needs to be free()ed at a later point to avoid a memory leak, this
 // function will return a null pointer if the decompression fails.
 uint8_t* deflate_decompress(void* data, size_t* length);
 
+// Decompress in_length bytes of data stored in the DEFLATE format, this will
+// return a buffer which needs to be free()ed at a later point to avoid a
+// memory leak, this function will return a null pointer if the decompression
+// fails or the data is truncated.
+uint8_t* deflate_decompress_bounded(const void* data, size_t in_length, size_t* length);
+
+// Decompress in_length bytes of data stored in the DEFLATE format, with the
+// output buffer allocated up front to hold expected bytes (it still grows if
+// the output turns out to be larger). This will return a buffer which needs to
+// be free()ed at a later point to avoid a memory leak, this function will
+// return a null pointer if the decompression fails or the data is truncated.
+uint8_t* deflate_decompress_sized(const void* data, size_t in_length, size_t expected, size_t* length);
+
+// Decompress in_length bytes of data stored in the DEFLATE format into a
+// buffer owned by the caller, storing the number of bytes written in length.
+// Returns 0 on success, and -1 if the decompression fails or the output does
+// not fit in out_length bytes.
+int deflate_decompress_into(const void* data, size_t in_length, void* output, size_t out_length, size_t* length);
+
+// Decompress in_length bytes of data stored in the zlib format (a DEFLATE
+// stream between a two byte header and an Adler-32 trailer), this will return
+// a buffer which needs to be free()ed at a later point to avoid a memory leak.
+// If verify is set the Adler-32 of the output must match the trailer. This
+// function will return a null pointer if the decompression fails.
+uint8_t* zlib_decompress(const void* data, size_t in_length, size_t* length, int verify);
+
+// Decompress in_length bytes of data stored in the zlib format into a buffer
+// owned by the caller, storing the number of bytes written in length. If
+// verify is set the Adler-32 of the output must match the trailer. Returns 0
+// on success, and -1 if the decompression fails or the output does not fit in
+// out_length bytes.
+int zlib_decompress_into(const void* data, size_t in_length, void* output, size_t out_length, size_t* length, int verify);
+
+// Allocate the state for a new incremental decompression, returns a null
+// pointer if the allocation fails. Only a fixed 32 KiB window of the output is
+// kept, so memory use does not depend on the size of the data.
+struct inflate_state* inflate_init();
+
+// Decompress as much of the input as possible into the output chunk. The
+// number of input bytes used is stored in consumed, and any bytes which were
+// not consumed must be passed in again on the next call. The number of bytes
+// written is stored in produced. Returns INFLATE_DONE once the final block has
+// been decoded, INFLATE_ERROR if the data is malformed, and INFLATE_OK if
+// either more input or more output space is needed (if produced is equal to
+// out_length, call again with a fresh output chunk before adding input). If
+// enabled by inflate_stop_at_blocks, INFLATE_BLOCK is returned at the start of
+// each block, and the call can simply be repeated with the remaining input.
+int inflate_feed(struct inflate_state* state, const void* input, size_t in_length, size_t* consumed, void* output, size_t out_length, size_t* produced);
+
+// Keep a checksum of the decompressed data, computed over each chunk of output
+// as it is produced. This must be set before the first call to inflate_feed.
+void inflate_set_check(struct inflate_state* state, int check);
+
+// Checksum of all of the output so far, as selected by inflate_set_check
+uint32_t inflate_check_value(const struct inflate_state* state);
+
+// Make inflate_feed return INFLATE_BLOCK whenever it reaches the start of a
+// block, which are the only points decompression can later be resumed from
+void inflate_stop_at_blocks(struct inflate_state* state, int stop);
+
+// Position of the decompression, as the number of bits of input consumed and
+// the number of bytes of output produced
+void inflate_position(const struct inflate_state* state, uint64_t* in_bits, uint64_t* out_bytes);
+
+// Copy the most recent output (at most 32 KiB of it), which later matches can
+// refer back into, to dest in order. Returns the number of bytes copied.
+size_t inflate_window(const struct inflate_state* state, uint8_t* dest);
+
+// Start a new decompression part way through a stream, at the start of a
+// block. The window is the output preceding that point (as returned by
+// inflate_window), and the count (less than 8) bits of value are the part of
+// the block which share a byte with the end of the previous one. This must be
+// called before the first call to inflate_feed.
+void inflate_resume(struct inflate_state* state, const uint8_t* window, size_t length, uint32_t value, size_t count);
+
+// Free the state of an incremental decompression
+void inflate_end(struct inflate_state* state);
+
+// Compress data in the DEFLATE format at the given level, this will return a
+// buffer which needs to be free()ed at a later point to avoid a memory leak,
+// this function will return a null pointer if the compression fails.
+uint8_t* deflate_compress(const void* data, size_t length, int level, size_t* out_length);
+
+// Allocate the state for a new compression at the given level (0 stores the
+// data uncompressed, 1 is the fastest and 9 gives the smallest output),
+// returns a null pointer if the allocation fails
+struct deflate_state* deflate_init(int level);
+
+// Compress the input, which is always consumed completely. Once final is set
+// the stream is finished and no more input can be given. A pointer to the
+// compressed bytes produced by this call is stored in output, which stays
+// valid until the next call. Returns 0 on success and -1 on failure.
+int deflate_feed(struct deflate_state* state, const void* input, size_t in_length, int final, const uint8_t** output, size_t* out_length);
+
+// Free the state of a compression
+void deflate_end(struct deflate_state* state);
+
+// Allocate the state for writing a new gzip member, compressed at the given
+// level. The name (which may be a null pointer) and modification time are
+// stored in the header. Returns a null pointer if the allocation fails.
+struct gzip_writer* gzip_writer_init(int level, const char* name, uint32_t mtime);
+
+// Compress the input, which is always consumed completely. Once final is set
+// the trailer is written and no more input can be given. A pointer to the
+// bytes of the member produced by this call is stored in output, which stays
+// valid until the next call. Returns 0 on success and -1 on failure.
+int gzip_writer_feed(struct gzip_writer* writer, const void* input, size_t in_length, int final, const uint8_t** output, size_t* out_length);
+
+// Free the state of a gzip member writer
+void gzip_writer_end(struct gzip_writer* writer);
+
+// Find the length of the gzip header at the start of the data, returns 0 if
+// the header is invalid or incomplete
+size_t gzip_header_length(const void* data, size_t length);
+
+// Decompress a gzip file held in memory which contains a single member. The
+// output is allocated once, using the size stored in the trailer, and the crc
+// is checked if verify is set. This will return a buffer which needs to be
+// free()ed at a later point to avoid a memory leak, this function will return
+// a null pointer if the decompression fails.
+uint8_t* gzip_decompress(const void* data, size_t length, size_t* out_length, int verify);
+
+// Build an index of the gzip data held in memory, with a checkpoint at the
+// first block boundary after every span bytes of output. Every member of the
+// file is decompressed (and its crc checked) once. Returns a null pointer if
+// the data is not valid gzip data or an allocation fails.
+struct gzip_index* gzip_index_build(const void* data, size_t length, size_t span);
+
+// Total length of the decompressed data covered by an index
+uint64_t gzip_index_size(const struct gzip_index* index);
+
+// Save an index to a sidecar file, returns 0 on success and -1 on failure
+int gzip_index_save(const struct gzip_index* index, const char* filename);
+
+// Load an index for the gzip data held in memory from a sidecar file. The
+// length and last 8 bytes of the data are compared against those the index
+// was built from, to catch a stale index. Returns a null pointer if the file
+// is missing, invalid or stale.
+struct gzip_index* gzip_index_load(const char* filename, const void* data, size_t compressed_length);
+
+// Free an index
+void gzip_index_free(struct gzip_index* index);
+
+// Start reading the decompressed data at the given offset, resuming from the
+// last checkpoint before it. The data must be the same gzip data the index was
+// built from, and must stay valid until the reader is ended. Returns a null
+// pointer if the allocation fails.
+struct gzip_reader* gzip_reader_open(const struct gzip_index* index, const void* data, size_t length, uint64_t offset);
+
+// Read up to length bytes of the decompressed data into the buffer, the number
+// of bytes read is stored in produced, which is only less than length at the
+// end of the data. Returns 0 on success and -1 if the data is corrupt.
+int gzip_reader_read(struct gzip_reader* reader, void* buffer, size_t length, size_t* produced);
+
+// Free a reader
+void gzip_reader_end(struct gzip_reader* reader);
+
+// Open a zip archive held in memory (which must stay valid until the archive
+// is closed) by reading its central directory. Returns a null pointer if the
+// archive is invalid or an allocation fails.
+struct zip_archive* zip_open(const void* data, size_t length);
+
+// Number of members in an archive
+size_t zip_entry_count(const struct zip_archive* archive);
+
+// Get the directory entry of a member by its index
+const struct zip_entry* zip_entry_at(const struct zip_archive* archive, size_t index);
+
+// Find a member by its full name within the archive, returns its index or -1
+// if there is no such member
+long zip_find(const struct zip_archive* archive, const char* name);
+
+// Extract a member, which must be stored or compressed with DEFLATE, checking
+// its crc if verify is set. This will return a buffer which needs to be
+// free()ed at a later point to avoid a memory leak, this function will return
+// a null pointer if the extraction fails.
+uint8_t* zip_extract(const struct zip_archive* archive, size_t index, size_t* length, int verify);
+
+// Free an archive, which does not touch the data it was opened from
+void zip_close(struct zip_archive* archive);
+
+// Number of heap allocations the library has made, which can be compared
+// before and after a call to find how many it made
+size_t zip_allocation_count();
+
+// Update a running CRC-32 (as used by gzip and PNG) with more data, the crc
+// of no data is zero
+uint32_t crc32_update(uint32_t crc, const void* data, size_t length);
+
+// Update a running Adler-32 (as used by the zlib format) with more data, the
+// checksum of no data is one
+uint32_t adler32_update(uint32_t adler, const void* data, size_t length);
+
 #endif // LIBZIP_H
\ No newline at end of file